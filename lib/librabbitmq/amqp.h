@@ -367,6 +367,10 @@ AMQP_PUBLIC_FUNCTION
 int
 AMQP_CALL amqp_get_channel_max(amqp_connection_state_t state);
 
+AMQP_PUBLIC_FUNCTION
+int
+AMQP_CALL amqp_get_frame_max(amqp_connection_state_t state);
+
 AMQP_PUBLIC_FUNCTION
 int
 AMQP_CALL amqp_destroy_connection(amqp_connection_state_t state);
@@ -393,6 +397,16 @@ AMQP_PUBLIC_FUNCTION
 int
 AMQP_CALL amqp_send_frame(amqp_connection_state_t state, amqp_frame_t const *frame);
 
+/*
+ * When enabled, amqp_basic_publish asks the kernel (MSG_MORE) to hold
+ * the method and header frames until the body is written, so a small
+ * message goes out as a single segment even with TCP_NODELAY set.
+ */
+AMQP_PUBLIC_FUNCTION
+void
+AMQP_CALL amqp_set_coalesce_frames(amqp_connection_state_t state,
+            amqp_boolean_t coalesce);
+
 AMQP_PUBLIC_FUNCTION
 int
 AMQP_CALL amqp_table_entry_cmp(void const *entry1, void const *entry2);
@@ -401,6 +415,13 @@ AMQP_PUBLIC_FUNCTION
 int
 AMQP_CALL amqp_open_socket(char const *hostname, int portnumber);
 
+struct timeval;
+
+AMQP_PUBLIC_FUNCTION
+int
+AMQP_CALL amqp_open_socket_timeout(char const *hostname, int portnumber,
+            struct timeval *timeout);
+
 AMQP_PUBLIC_FUNCTION
 int
 AMQP_CALL amqp_send_header(amqp_connection_state_t state);
@@ -414,6 +435,11 @@ int
 AMQP_CALL amqp_simple_wait_frame(amqp_connection_state_t state,
 		       amqp_frame_t *decoded_frame);
 
+AMQP_PUBLIC_FUNCTION
+int
+AMQP_CALL amqp_simple_poll_frame(amqp_connection_state_t state,
+		       amqp_frame_t *decoded_frame);
+
 AMQP_PUBLIC_FUNCTION
 int
 AMQP_CALL amqp_simple_wait_method(amqp_connection_state_t state,
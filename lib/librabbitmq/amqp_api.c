@@ -108,6 +108,7 @@ int amqp_basic_publish(amqp_connection_state_t state,
   amqp_frame_t f;
   size_t body_offset;
   size_t usable_body_payload_size = state->frame_max - (HEADER_SIZE + FOOTER_SIZE);
+  int more = state->coalesce_frames ? MSG_MORE : 0;
   int res;
 
   amqp_basic_publish_t m;
@@ -119,7 +120,12 @@ int amqp_basic_publish(amqp_connection_state_t state,
   m.immediate = immediate;
   m.ticket = 0;
 
-  res = amqp_send_method(state, channel, AMQP_BASIC_PUBLISH_METHOD, &m);
+  f.frame_type = AMQP_FRAME_METHOD;
+  f.channel = channel;
+  f.payload.method.id = AMQP_BASIC_PUBLISH_METHOD;
+  f.payload.method.decoded = &m;
+
+  res = amqp_send_frame_flags(state, &f, more);
   if (res < 0)
     return res;
 
@@ -134,7 +140,7 @@ int amqp_basic_publish(amqp_connection_state_t state,
   f.payload.properties.body_size = body.len;
   f.payload.properties.decoded = (void *) properties;
 
-  res = amqp_send_frame(state, &f);
+  res = amqp_send_frame_flags(state, &f, body.len ? more : 0);
   if (res < 0)
     return res;
 
@@ -155,7 +161,8 @@ int amqp_basic_publish(amqp_connection_state_t state,
     }
 
     body_offset += f.payload.body_fragment.len;
-    res = amqp_send_frame(state, &f);
+    res = amqp_send_frame_flags(state, &f,
+				body_offset < body.len ? more : 0);
     if (res < 0)
       return res;
   }
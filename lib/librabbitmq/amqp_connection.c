@@ -124,8 +124,14 @@ int amqp_tune_connection(amqp_connection_state_t state,
   init_amqp_pool(&state->frame_pool, frame_max);
 
   state->inbound_buffer.len = frame_max;
-  state->outbound_buffer.len = frame_max;
-  newbuf = realloc(state->outbound_buffer.bytes, frame_max);
+
+  /* Body frames are written straight from the caller's memory with
+     writev, so the outbound buffer only ever holds method and header
+     frames. Start small and let amqp_send_frame grow it up to
+     frame_max if a frame does not fit. */
+  state->outbound_buffer.len = (frame_max < AMQP_FRAME_MIN_SIZE)
+    ? frame_max : AMQP_FRAME_MIN_SIZE;
+  newbuf = realloc(state->outbound_buffer.bytes, state->outbound_buffer.len);
   if (newbuf == NULL) {
     amqp_destroy_connection(state);
     return -ERROR_NO_MEMORY;
@@ -135,10 +141,33 @@ int amqp_tune_connection(amqp_connection_state_t state,
   return 0;
 }
 
+static int grow_outbound_buffer(amqp_connection_state_t state)
+{
+  size_t len = state->outbound_buffer.len * 2;
+  void *newbuf;
+
+  if (state->outbound_buffer.len >= (size_t) state->frame_max)
+    return -ERROR_BAD_AMQP_DATA;
+  if (len > (size_t) state->frame_max)
+    len = state->frame_max;
+
+  newbuf = realloc(state->outbound_buffer.bytes, len);
+  if (newbuf == NULL)
+    return -ERROR_NO_MEMORY;
+
+  state->outbound_buffer.bytes = newbuf;
+  state->outbound_buffer.len = len;
+  return 0;
+}
+
 int amqp_get_channel_max(amqp_connection_state_t state) {
   return state->channel_max;
 }
 
+int amqp_get_frame_max(amqp_connection_state_t state) {
+  return state->frame_max;
+}
+
 int amqp_destroy_connection(amqp_connection_state_t state) {
   int s = state->sockfd;
 
@@ -340,12 +369,29 @@ void amqp_maybe_release_buffers(amqp_connection_state_t state) {
   }
 }
 
+void amqp_set_coalesce_frames(amqp_connection_state_t state,
+			      amqp_boolean_t coalesce)
+{
+  state->coalesce_frames = coalesce;
+}
+
 int amqp_send_frame(amqp_connection_state_t state,
 		    const amqp_frame_t *frame)
 {
-  void *out_frame = state->outbound_buffer.bytes;
+  return amqp_send_frame_flags(state, frame, 0);
+}
+
+/* flags are OR'ed into the send(2) flags; MSG_MORE lets the kernel hold
+   the frame back until the rest of the message has been written */
+int amqp_send_frame_flags(amqp_connection_state_t state,
+			  const amqp_frame_t *frame, int flags)
+{
+  void *out_frame;
   int res;
 
+ again:
+  out_frame = state->outbound_buffer.bytes;
+
   amqp_e8(out_frame, 0, frame->frame_type);
   amqp_e16(out_frame, 1, frame->channel);
 
@@ -353,6 +399,7 @@ int amqp_send_frame(amqp_connection_state_t state,
     /* For a body frame, rather than copying data around, we use
        writev to compose the frame */
     struct iovec iov[3];
+    struct msghdr msg;
     uint8_t frame_end_byte = AMQP_FRAME_END;
     const amqp_bytes_t *body = &frame->payload.body_fragment;
 
@@ -365,7 +412,11 @@ int amqp_send_frame(amqp_connection_state_t state,
     iov[2].iov_base = &frame_end_byte;
     iov[2].iov_len = FOOTER_SIZE;
 
-    res = amqp_socket_writev(state->sockfd, iov, 3);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+
+    res = sendmsg(state->sockfd, &msg, MSG_NOSIGNAL | flags);
   }
   else {
     size_t out_frame_len;
@@ -380,6 +431,8 @@ int amqp_send_frame(amqp_connection_state_t state,
 
       res = amqp_encode_method(frame->payload.method.id,
                                frame->payload.method.decoded, encoded);
+      if (res == -ERROR_BAD_AMQP_DATA && grow_outbound_buffer(state) == 0)
+        goto again;
       if (res < 0)
         return res;
 
@@ -396,6 +449,8 @@ int amqp_send_frame(amqp_connection_state_t state,
 
       res = amqp_encode_properties(frame->payload.properties.class_id,
                                    frame->payload.properties.decoded, encoded);
+      if (res == -ERROR_BAD_AMQP_DATA && grow_outbound_buffer(state) == 0)
+        goto again;
       if (res < 0)
         return res;
 
@@ -413,7 +468,7 @@ int amqp_send_frame(amqp_connection_state_t state,
     amqp_e32(out_frame, 3, out_frame_len);
     amqp_e8(out_frame, out_frame_len + HEADER_SIZE, AMQP_FRAME_END);
     res = send(state->sockfd, out_frame,
-               out_frame_len + HEADER_SIZE + FOOTER_SIZE, MSG_NOSIGNAL);
+               out_frame_len + HEADER_SIZE + FOOTER_SIZE, MSG_NOSIGNAL | flags);
   }
 
   if (res < 0)
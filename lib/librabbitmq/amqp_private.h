@@ -112,6 +112,9 @@ typedef enum amqp_connection_state_enum_ {
   CONNECTION_STATE_BODY
 } amqp_connection_state_enum;
 
+/* frame_max used when neither side of the negotiation sets a limit */
+#define AMQP_DEFAULT_FRAME_SIZE 131072
+
 /* 7 bytes up front, then payload, then 1 byte footer */
 #define HEADER_SIZE 7
 #define FOOTER_SIZE 1
@@ -147,6 +150,8 @@ struct amqp_connection_state_t_ {
   amqp_link_t *first_queued_frame;
   amqp_link_t *last_queued_frame;
 
+  amqp_boolean_t coalesce_frames;
+
   amqp_rpc_reply_t most_recent_api_result;
 };
 
@@ -277,6 +282,10 @@ static inline int amqp_decode_bytes(amqp_bytes_t encoded, size_t *offset,
   }
 }
 
+int
+amqp_send_frame_flags(amqp_connection_state_t state,
+		      const amqp_frame_t *frame, int flags);
+
 AMQP_NORETURN
 void
 amqp_abort(const char *fmt, ...);
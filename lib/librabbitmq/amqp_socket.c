@@ -44,6 +44,17 @@
 
 int amqp_open_socket(char const *hostname,
 		     int portnumber)
+{
+  struct timeval timeout;
+  timeout.tv_sec = 2;
+  timeout.tv_usec = 0;
+
+  return amqp_open_socket_timeout(hostname, portnumber, &timeout);
+}
+
+int amqp_open_socket_timeout(char const *hostname,
+			     int portnumber,
+			     struct timeval *timeout)
 {
   struct addrinfo hint;
   struct addrinfo *address_list;
@@ -86,18 +97,14 @@ int amqp_open_socket(char const *hostname,
     /*
       Set SO_RCVTIMEO and SO_SNDTIMEO on socket
     */
-    struct timeval timeout;      
-    timeout.tv_sec = 2;
-    timeout.tv_usec = 0;
-
-    if (0 != amqp_socket_setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) )
+    if (0 != amqp_socket_setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, timeout, sizeof(*timeout)) )
     {
       last_error = -amqp_socket_error();
       amqp_socket_close(sockfd);
       continue;
     }
     
-    if (0 != amqp_socket_setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) )
+    if (0 != amqp_socket_setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, timeout, sizeof(*timeout)) )
     {
       last_error = -amqp_socket_error();
       amqp_socket_close(sockfd);
@@ -260,6 +267,54 @@ int amqp_simple_wait_frame(amqp_connection_state_t state,
   }
 }
 
+/*
+ * Non-blocking variant of amqp_simple_wait_frame: returns 1 and fills
+ * decoded_frame when a complete frame is available, 0 when the socket
+ * has nothing more to give right now, and a negative error otherwise.
+ */
+int amqp_simple_poll_frame(amqp_connection_state_t state,
+			   amqp_frame_t *decoded_frame)
+{
+  int res;
+
+  if (state->first_queued_frame != NULL) {
+    res = amqp_simple_wait_frame(state, decoded_frame);
+    return res < 0 ? res : 1;
+  }
+
+  while (1) {
+    while (amqp_data_in_buffer(state)) {
+      amqp_bytes_t buffer;
+      buffer.len = state->sock_inbound_limit - state->sock_inbound_offset;
+      buffer.bytes = ((char *) state->sock_inbound_buffer.bytes) + state->sock_inbound_offset;
+
+      res = amqp_handle_input(state, buffer, decoded_frame);
+      if (res < 0)
+	return res;
+
+      state->sock_inbound_offset += res;
+
+      if (decoded_frame->frame_type != 0)
+	return 1;
+
+      assert(res != 0);
+    }
+
+    res = recv(state->sockfd, state->sock_inbound_buffer.bytes,
+		  state->sock_inbound_buffer.len, MSG_DONTWAIT);
+    if (res <= 0) {
+      if (res == 0)
+	return -ERROR_CONNECTION_CLOSED;
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+	return 0;
+      return -amqp_socket_error();
+    }
+
+    state->sock_inbound_limit = res;
+    state->sock_inbound_offset = 0;
+  }
+}
+
 int amqp_simple_wait_method(amqp_connection_state_t state,
 			    amqp_channel_t expected_channel,
 			    amqp_method_number_t expected_method,
@@ -449,7 +504,8 @@ static int amqp_login_inner(amqp_connection_state_t state,
   }
 
   {
-    amqp_table_entry_t properties[2];
+    amqp_table_entry_t properties[3];
+    amqp_table_entry_t capabilities[1];
     amqp_connection_start_ok_t s;
     amqp_bytes_t response_bytes = sasl_response(&state->decoding_pool,
 						sasl_method, vl);
@@ -467,7 +523,18 @@ static int amqp_login_inner(amqp_connection_state_t state,
     properties[1].value.value.bytes
       = amqp_cstring_bytes("See http://hg.rabbitmq.com/rabbitmq-c/");
 
-    s.client_properties.num_entries = 2;
+    /* let the broker know we understand connection.blocked so it tells
+       us when it stops reading instead of silently stalling our sends */
+    capabilities[0].key = amqp_cstring_bytes("connection.blocked");
+    capabilities[0].value.kind = AMQP_FIELD_KIND_BOOLEAN;
+    capabilities[0].value.value.boolean = 1;
+
+    properties[2].key = amqp_cstring_bytes("capabilities");
+    properties[2].value.kind = AMQP_FIELD_KIND_TABLE;
+    properties[2].value.value.table.num_entries = 1;
+    properties[2].value.value.table.entries = capabilities;
+
+    s.client_properties.num_entries = 3;
     s.client_properties.entries = properties;
     s.mechanism = sasl_method_name(sasl_method);
     s.response = response_bytes;
@@ -496,7 +563,12 @@ static int amqp_login_inner(amqp_connection_state_t state,
   if (server_channel_max != 0 && server_channel_max < channel_max)
     channel_max = server_channel_max;
 
-  if (server_frame_max != 0 && server_frame_max < frame_max)
+  /* a frame_max of 0 means we have no preference: take whatever the
+     broker offers, and fall back to the usual default if it does not
+     set a limit either */
+  if (frame_max == 0)
+    frame_max = server_frame_max ? server_frame_max : AMQP_DEFAULT_FRAME_SIZE;
+  else if (server_frame_max != 0 && server_frame_max < frame_max)
     frame_max = server_frame_max;
 
   if (server_heartbeat != 0 && server_heartbeat < heartbeat)
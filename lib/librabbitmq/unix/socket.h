@@ -59,6 +59,10 @@ amqp_socket_error(void);
 # define MSG_NOSIGNAL 0x0
 #endif
 
+#ifndef MSG_MORE
+# define MSG_MORE 0x0
+#endif
+
 #if defined(SO_NOSIGPIPE) && !defined(MSG_NOSIGNAL)
 # define DISABLE_SIGPIPE_WITH_SETSOCKOPT
 #endif
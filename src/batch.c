@@ -0,0 +1,177 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include "nagios.h"
+#include "logger.h"
+#include "xutils.h"
+#include "module.h"
+#include "neb2amqp.h"
+#include "batch.h"
+#include "worker.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+extern struct options g_options;
+
+static char *batch = NULL;
+static size_t batch_len = 0;
+static int batch_count = 0;
+static struct timeval batch_start;
+static char *batch_key = NULL;
+/* json batches are '[' event (',' event)* ']', msgpack ones start with a
+ * 5 bytes array header */
+static size_t batch_head = 0;
+static size_t batch_sep = 1;
+static size_t batch_tail = 1;
+
+static long
+batch_age (void)
+{
+    struct timeval now;
+    gettimeofday (&now, NULL);
+    return (now.tv_sec - batch_start.tv_sec) * 1000
+        + (now.tv_usec - batch_start.tv_usec) / 1000;
+}
+
+/**
+ * nagios timed events only have a one second resolution, so 'batch_delay'
+ * is checked on every event and this timer only makes sure a batch does
+ * not stay around when the events stop coming.
+ */
+static void
+batch_timer (void *unused __attribute__ ((__unused__)))
+{
+    n2a_lock ();
+    if (batch_count > 0 && batch_age () >= g_options.batch_delay)
+        n2a_batch_flush ();
+    n2a_unlock ();
+#ifndef DEBUG
+    schedule_new_event(EVENT_USER_FUNCTION,
+                       TRUE,
+                       time (NULL) + 1,
+                       FALSE,
+                       1,
+                       NULL,
+                       TRUE,
+                       (void *)batch_timer,
+                       NULL,
+                       0);
+#endif
+}
+
+void
+n2a_init_batch (void)
+{
+    /* the snapshot sends its states by batches in any case */
+    if (g_options.batch_size <= 0 && g_options.snapshot <= 0)
+        return;
+
+    size_t l = xstrlen (g_options.connector) + xstrlen (g_options.eventsource_name) + 8;
+    batch_key = xmalloc (l);
+    snprintf (batch_key, l, "%s.%s.batch", g_options.connector, g_options.eventsource_name);
+
+    if (g_options.encoding == N2A_MSG_MSGPACK) {
+        batch_head = 5;
+        batch_sep = batch_tail = 0;
+    }
+    /* a batch never exceeds max_size, + 1 for the json NUL */
+    batch = xmalloc (g_options.max_size + 1);
+    batch_len = batch_head;
+    batch_count = 0;
+
+    /* the snapshot flushes its batches itself */
+    if (g_options.batch_size <= 0)
+        return;
+    n2a_logger (LG_INFO, "batching up to %d events or %dms on '%s'",
+                g_options.batch_size, g_options.batch_delay, batch_key);
+    batch_timer (NULL);
+}
+
+void
+n2a_deinit_batch (void)
+{
+    n2a_batch_flush ();
+    xfree (batch);
+    xfree (batch_key);
+    batch = NULL;
+    batch_key = NULL;
+}
+
+int
+n2a_batch_enabled (void)
+{
+    return batch != NULL && g_options.batch_size > 0;
+}
+
+int
+n2a_batch_add (const char *routingkey, const char *message, size_t len)
+{
+    int r = 0;
+
+    if (batch == NULL)
+        return amqp_publish_format (routingkey, message, len, g_options.encoding);
+
+    /* an event too big to share a batch is sent alone, after the ones
+     * already in the batch (amqp_publish_format flushes it first) */
+    if (batch_head + batch_sep + len + batch_tail > (size_t) g_options.max_size)
+        return amqp_publish_format (routingkey, message, len, g_options.encoding);
+
+    if (batch_len + batch_sep + len + batch_tail > (size_t) g_options.max_size)
+        r = n2a_batch_flush ();
+
+    if (batch_sep)
+        batch[batch_len++] = batch_count == 0 ? '[' : ',';
+    memcpy (batch + batch_len, message, len);
+    batch_len += len;
+    if (batch_count++ == 0)
+        gettimeofday (&batch_start, NULL);
+
+    if ((g_options.batch_size > 0 && batch_count >= g_options.batch_size)
+        || batch_age () >= g_options.batch_delay)
+        r |= n2a_batch_flush ();
+    return r;
+}
+
+int
+n2a_batch_flush (void)
+{
+    size_t len = batch_len;
+
+    if (batch_count == 0)
+        return 0;
+
+    if (g_options.encoding == N2A_MSG_MSGPACK) {
+        /* array32 header, its room was kept at the start of the buffer */
+        batch[0] = (char) 0xdd;
+        batch[1] = (batch_count >> 24) & 0xff;
+        batch[2] = (batch_count >> 16) & 0xff;
+        batch[3] = (batch_count >> 8) & 0xff;
+        batch[4] = batch_count & 0xff;
+    } else {
+        batch[len++] = ']';
+        batch[len] = '\0';
+    }
+    n2a_logger (LG_DEBUG, "sending a batch of %d events (%d bytes)", batch_count, (int) len);
+    batch_len = batch_head;
+    batch_count = 0;
+    /* a failed batch is cached as a whole, like any other message */
+    return amqp_publish_format (batch_key, batch, len, N2A_MSG_BATCH | g_options.encoding);
+}
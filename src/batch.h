@@ -0,0 +1,53 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef batch_h
+#define batch_h
+
+#include <stddef.h>
+
+/**
+ * batching mode: with 'batch_size' > 0 the events are not published one by
+ * one but accumulated into an array (JSON or MessagePack, depending on
+ * 'encoding') sent as a single message on the
+ * '<connector>.<name>.batch' routing key. a batch goes out when it holds
+ * 'batch_size' events, when it is 'batch_delay' ms old or when the next
+ * event would make it bigger than 'max_size'. it is also sent ahead of any
+ * message which does not go through it (too big, split in parts, ...) so
+ * the events keep their order.
+ */
+void n2a_init_batch (void);
+void n2a_deinit_batch (void);
+
+/* returns TRUE if the events have to go through n2a_batch_add */
+int n2a_batch_enabled (void);
+
+/**
+ * append one JSON event to the current batch, sending the batch when it is
+ * full. returns the amqp_publish result of what was sent, 0 otherwise.
+ * the snapshot states always come here: with 'batch_size' = 0 their batch
+ * is only bounded by 'max_size' and 'batch_delay', and it is flushed at
+ * the end of each slice.
+ */
+int n2a_batch_add (const char *routingkey, const char *message, size_t len);
+
+/* send the current batch right away */
+int n2a_batch_flush (void);
+
+#endif
@@ -65,6 +65,28 @@ verify_event_broker_options ()
       errors++;
     }
     
+  /* the other events are optional, they just never come without these */
+  if (g_options.acknowledgements && !(event_broker_options & BROKER_ACKNOWLEDGEMENT_DATA))
+    n2a_logger (LG_WARN,
+	    "acknowledgements need BROKER_ACKNOWLEDGEMENT_DATA (%i) event_broker_option enabled.",
+	    BROKER_ACKNOWLEDGEMENT_DATA);
+  if (g_options.downtimes && !(event_broker_options & BROKER_DOWNTIME_DATA))
+    n2a_logger (LG_WARN,
+	    "downtimes need BROKER_DOWNTIME_DATA (%i) event_broker_option enabled.",
+	    BROKER_DOWNTIME_DATA);
+  if (g_options.comments && !(event_broker_options & BROKER_COMMENT_DATA))
+    n2a_logger (LG_WARN,
+	    "comments need BROKER_COMMENT_DATA (%i) event_broker_option enabled.",
+	    BROKER_COMMENT_DATA);
+  if (*g_options.custom_vars && !(event_broker_options & BROKER_EXTERNALCOMMAND_DATA))
+    n2a_logger (LG_WARN,
+	    "custom_vars need BROKER_EXTERNALCOMMAND_DATA (%i) event_broker_option enabled to follow their changes.",
+	    BROKER_EXTERNALCOMMAND_DATA);
+  if (g_options.program_status > 0 && !(event_broker_options & BROKER_STATUS_DATA))
+    n2a_logger (LG_WARN,
+	    "program_status needs BROKER_STATUS_DATA (%i) event_broker_option enabled.",
+	    BROKER_STATUS_DATA);
+
   /*if (!(event_broker_options & BROKER_LOGGED_DATA))
     {
       n2a_logger (LG_CRIT,
@@ -128,26 +150,39 @@ void
 register_callbacks ()
 {
   //neb_register_callback (NEBCALLBACK_PROCESS_DATA,			g_options.nagios_handle, 0, event_process);
-  //neb_register_callback (NEBCALLBACK_PROGRAM_STATUS_DATA,	g_options.nagios_handle, 0, event_program_status);
+  if (g_options.program_status > 0)
+    neb_register_callback (NEBCALLBACK_PROGRAM_STATUS_DATA,	g_options.nagios_handle, 0, event_program_status);
 
   neb_register_callback (NEBCALLBACK_SERVICE_CHECK_DATA,    g_options.nagios_handle, 0, n2a_event_service_check);
   neb_register_callback (NEBCALLBACK_HOST_CHECK_DATA,       g_options.nagios_handle, 0, n2a_event_host_check);
 
-  //neb_register_callback (NEBCALLBACK_ACKNOWLEDGEMENT_DATA,	g_options.nagios_handle, 0, event_acknowledgement);
-  //neb_register_callback (NEBCALLBACK_DOWNTIME_DATA, 		g_options.nagios_handle, 0, event_downtime);
-  //neb_register_callback (NEBCALLBACK_COMMENT_DATA, 			g_options.nagios_handle, 0, event_comment);
+  /* registered only when asked for, they cost nothing otherwise */
+  if (g_options.acknowledgements)
+    neb_register_callback (NEBCALLBACK_ACKNOWLEDGEMENT_DATA,	g_options.nagios_handle, 0, event_acknowledgement);
+  if (g_options.downtimes)
+    neb_register_callback (NEBCALLBACK_DOWNTIME_DATA, 		g_options.nagios_handle, 0, event_downtime);
+  if (g_options.comments)
+    neb_register_callback (NEBCALLBACK_COMMENT_DATA, 			g_options.nagios_handle, 0, event_comment);
+  if (*g_options.custom_vars)
+    neb_register_callback (NEBCALLBACK_EXTERNAL_COMMAND_DATA,	g_options.nagios_handle, 0, n2a_event_external_command);
 }
 
 void
 deregister_callbacks ()
 {
   //neb_deregister_callback (NEBCALLBACK_PROCESS_DATA,			event_process);
-  //neb_deregister_callback (NEBCALLBACK_PROGRAM_STATUS_DATA, 	event_program_status);
+  if (g_options.program_status > 0)
+    neb_deregister_callback (NEBCALLBACK_PROGRAM_STATUS_DATA, 	event_program_status);
 
   neb_deregister_callback (NEBCALLBACK_SERVICE_CHECK_DATA,		n2a_event_service_check);
   neb_deregister_callback (NEBCALLBACK_HOST_CHECK_DATA,			n2a_event_host_check);
   
-  //neb_deregister_callback (NEBCALLBACK_ACKNOWLEDGEMENT_DATA,	event_acknowledgement);
-  //neb_deregister_callback (NEBCALLBACK_DOWNTIME_DATA,			event_downtime);
-  //neb_deregister_callback (NEBCALLBACK_COMMENT_DATA,			event_comment);
+  if (g_options.acknowledgements)
+    neb_deregister_callback (NEBCALLBACK_ACKNOWLEDGEMENT_DATA,	event_acknowledgement);
+  if (g_options.downtimes)
+    neb_deregister_callback (NEBCALLBACK_DOWNTIME_DATA,			event_downtime);
+  if (g_options.comments)
+    neb_deregister_callback (NEBCALLBACK_COMMENT_DATA,			event_comment);
+  if (*g_options.custom_vars)
+    neb_deregister_callback (NEBCALLBACK_EXTERNAL_COMMAND_DATA,	n2a_event_external_command);
 }
@@ -22,6 +22,9 @@
 #include "xutils.h"
 #include "module.h"
 #include "cache.h"
+#include "neb2amqp.h"
+#include "intern.h"
+#include "worker.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,18 +36,32 @@
 #include "iniparser.h"
 
 extern struct options g_options;
-extern unsigned int amqp_connected;
 
+/**
+ * the cache is one backlog shared by every broker: messages are stored once
+ * as cache:key_N / cache:message_N with N in [firstid, lastid] and each
+ * broker keeps a cursor on the next message it still has to receive.
+ * a message is dropped from the cache once every cursor went past it.
+ * cache:key_N only holds the id of the routing key, the keys themselves are
+ * stored once in the keys section (keys:ID) and interned in memory.
+ */
 static dictionary *ini = NULL;
 static unsigned int dbsetup = FALSE;
 static time_t last_flush = 0;
 static time_t last_pop = 0;
-static unsigned int ini_lock = FALSE;
+static int firstid = 1;
 static int lastid = 0;
+static int cursor[N2A_MAX_BROKERS];
 static unsigned int pop_lock = FALSE;
-static const char *tkey = NULL, *tmsg = NULL;
-static unsigned int purge_cache = FALSE;
-int c_size = -10000;
+static unsigned int purge_cache = 0;
+/* what the cache file holds: messages up to 'synced_lastid' and these
+ * cursors. 'rewrite' once a message was removed, appending is not enough */
+static int synced_lastid = 0;
+static int synced_cursor[N2A_MAX_BROKERS];
+static unsigned int rewrite = TRUE;
+/* routing keys added since */
+static unsigned int *new_keys = NULL;
+static int nnew_keys = 0;
 
 static int compare (const void * a, const void * b)
 {
@@ -105,6 +122,9 @@ n2a_clear_cache (void)
     unsigned int force = TRUE;
     n2a_flush_cache (&force);
     iniparser_freedict (ini);
+    xfree (new_keys);
+    new_keys = NULL;
+    nnew_keys = 0;
 }
 
 #ifdef DEBUG
@@ -118,10 +138,88 @@ alarm_handler (int sig)
 }
 #endif
 
+/* read back the interned routing keys */
+static void
+load_keys (void)
+{
+    int i, n = iniparser_getsecnkeys (ini, "keys");
+    char **keys;
+
+    if (n <= 0)
+        return;
+    keys = iniparser_getseckeys (ini, "keys");
+    for (i = 0; i < n; i++) {
+        unsigned int id = strtoul (strchr (keys[i], ':') + 1, NULL, 10);
+        char *value = iniparser_getstring (ini, keys[i], NULL);
+        if (n2a_intern_id (value, id) != id) {
+            n2a_logger (LG_CRIT, "CACHE: dropping conflicting key %u '%s'",
+                        id, value ? value : "");
+            iniparser_unset (ini, keys[i]);
+        }
+    }
+    xfree (keys);
+}
+
+/* the routing keys no cached message refers to anymore */
+static void
+drop_unused_keys (void)
+{
+    int i, n = iniparser_getsecnkeys (ini, "keys"), dropped = 0;
+    unsigned int id, max = 0;
+    unsigned char *used;
+    char **keys, index[256];
+
+    if (n <= 0)
+        return;
+    keys = iniparser_getseckeys (ini, "keys");
+    for (i = 0; i < n; i++) {
+        id = strtoul (strchr (keys[i], ':') + 1, NULL, 10);
+        if (id > max)
+            max = id;
+    }
+    used = xmalloc (max + 1);
+    memset (used, 0, max + 1);
+    for (i = firstid; i <= lastid; i++) {
+        snprintf (index, 256, "cache:key_%d", i);
+        id = strtoul (iniparser_getstring (ini, index, "0"), NULL, 10);
+        if (id <= max)
+            used[id] = TRUE;
+    }
+    for (i = 0; i < n; i++) {
+        if (!used[strtoul (strchr (keys[i], ':') + 1, NULL, 10)]) {
+            iniparser_unset (ini, keys[i]);
+            dropped++;
+        }
+    }
+    xfree (used);
+    xfree (keys);
+    if (dropped > 0)
+        n2a_logger (LG_DEBUG, "CACHE: dropped %d unused routing keys", dropped);
+}
+
+/* routing key of a cached message, old caches hold the key itself */
+static const char *
+message_key (const char *value)
+{
+    char *end;
+    unsigned long id;
+    const char *key;
+
+    if (value == NULL)
+        return NULL;
+    id = strtoul (value, &end, 10);
+    if (*value != '\0' && *end == '\0'
+        && (key = n2a_intern_string ((unsigned int) id)) != NULL)
+        return key;
+    return value;
+}
+
 void
 n2a_init_cache (void)
 {
-    purge_cache = g_options.purge;
+    int i;
+    char index[256];
+    purge_cache = g_options.purge ? ~0U : 0;
     /* test if the db file already exists */
     if (!file_exists (g_options.cache_file)) {
         /* if it does not, create an empty one */
@@ -166,19 +264,40 @@ n2a_init_cache (void)
         n2a_logger (LG_CRIT, "invalid cache file! No 'cache' entry found");
         iniparser_set (ini, "cache", NULL);
     }
+    if (!iniparser_find_entry (ini, "cursor"))
+        iniparser_set (ini, "cursor", NULL);
+    if (!iniparser_find_entry (ini, "format"))
+        iniparser_set (ini, "format", NULL);
+    if (!iniparser_find_entry (ini, "part"))
+        iniparser_set (ini, "part", NULL);
+    if (!iniparser_find_entry (ini, "keys"))
+        iniparser_set (ini, "keys", NULL);
+    load_keys ();
     int n = iniparser_getsecnkeys (ini, "cache");
     if (n > 0) {
         char **keys = iniparser_getseckeys (ini, "cache");
-        /* sort the returned keys */
+        /* sort the returned keys: key_* first, then message_* */
         qsort (keys, (size_t) n, sizeof (char *), compare);
-        char *index_key = keys[n-1];
+        char *m = strchr (keys[0], '_');
+        firstid = strtol (m+1, NULL, 10);
+        m = strchr (keys[n-1], '_');
+        lastid = strtol (m+1, NULL, 10);
         /* then free the list although the doc says not to... */
         xfree (keys);
-        char *m = strchr (index_key, '_');
-        lastid = strtol (m+1, NULL, 10);
         n2a_logger (LG_INFO, "retrieved %d messages from cache", n/2);
-        c_size = n;
     }
+    drop_unused_keys ();
+    /* a broker without a saved cursor (first run, new mirror) gets the
+     * whole backlog */
+    for (i = 0; i < N2A_MAX_BROKERS; i++) {
+        snprintf (index, 256, "cursor:broker_%d", i);
+        cursor[i] = iniparser_getint (ini, index, firstid);
+        cursor[i] = xmax (firstid, xmin (cursor[i], lastid + 1));
+    }
+
+    synced_lastid = lastid;
+    memcpy (synced_cursor, cursor, sizeof (cursor));
+    rewrite = FALSE;
 
     dbsetup = TRUE;
     unsigned int force = FALSE;
@@ -210,12 +329,94 @@ n2a_init_cache (void)
 #endif
 }
 
+/* one section of the messages added since the last sync, as iniparser
+ * would dump it */
+static void
+append_section (FILE *db, const char *section, const char *format)
+{
+    char name[256], index[sizeof (name) + 16];
+    const char *value;
+    int id;
+
+    fprintf (db, "\n[%s]\n", section);
+    for (id = synced_lastid + 1; id <= lastid; id++) {
+        snprintf (name, 256, format, id);
+        snprintf (index, sizeof (index), "%s:%s", section, name);
+        if ((value = iniparser_getstring (ini, index, NULL)) != NULL)
+            fprintf (db, "%-30s = %s\n", name, value);
+    }
+}
+
+/**
+ * write the cache to 'cache_file'. while messages are only added (the
+ * broker is away), the new ones and the cursors are appended: the file
+ * is loaded section by section, the last value of a key wins. once a
+ * message was removed the whole file is rewritten, the cache is then
+ * usually small. nothing is written when nothing changed.
+ */
+static void
+sync_cache (void)
+{
+    int i, added = lastid - synced_lastid, moved = FALSE;
+    char index[256], name[256], value[32];
+    FILE *db;
+
+    for (i = 0; i < n2a_broker_count (); i++)
+        moved |= (cursor[i] != synced_cursor[i]);
+    if (!rewrite && added <= 0 && !moved)
+        return;
+
+    for (i = 0; i < n2a_broker_count (); i++) {
+        snprintf (index, 256, "cursor:broker_%d", i);
+        snprintf (value, 32, "%d", cursor[i]);
+        iniparser_set (ini, index, value);
+    }
+
+    db = fopen (g_options.cache_file, rewrite ? "w" : "a");
+    if (db == NULL) {
+        n2a_logger (LG_CRIT, "CACHE: flush error: %s", strerror (errno));
+        return;
+    }
+    if (rewrite) {
+        iniparser_dump_ini (ini, db);
+        if (lastid >= firstid)
+            n2a_logger (LG_INFO, "syncing %d messages from cache to disk (into: '%s')",
+                        lastid - firstid + 1, g_options.cache_file);
+    } else {
+        fprintf (db, "\n[keys]\n");
+        for (i = 0; i < nnew_keys; i++) {
+            snprintf (name, 256, "%u", new_keys[i]);
+            snprintf (index, 256, "keys:%u", new_keys[i]);
+            fprintf (db, "%-30s = %s\n", name, iniparser_getstring (ini, index, ""));
+        }
+        append_section (db, "cache", "key_%d");
+        append_section (db, "cache", "message_%d");
+        append_section (db, "format", "%d");
+        append_section (db, "part", "%d");
+        fprintf (db, "\n[cursor]\n");
+        for (i = 0; i < n2a_broker_count (); i++) {
+            snprintf (name, 256, "broker_%d", i);
+            fprintf (db, "%-30s = %d\n", name, cursor[i]);
+        }
+        if (added > 0)
+            n2a_logger (LG_INFO, "appending %d messages from cache to disk (into: '%s')",
+                        added, g_options.cache_file);
+    }
+    fclose (db);
+
+    synced_lastid = lastid;
+    memcpy (synced_cursor, cursor, sizeof (cursor));
+    rewrite = FALSE;
+    nnew_keys = 0;
+}
+
 void
 n2a_flush_cache (void *pf)
 {
     unsigned int force = *(int *)pf;
     unsigned int f = FALSE;
     time_t now = 0;
+    n2a_lock ();
     if ((!dbsetup || g_options.autosync < 0) && !force)
         goto reschedule;
     /* i know... gotos are a mess, but here i wanna avoid this comparison when
@@ -229,21 +430,12 @@ n2a_flush_cache (void *pf)
 
 do_it:
     last_flush = now;
-    FILE *db = fopen (g_options.cache_file, "w");
-    if (db != NULL) {
-        if (c_size == -10000)
-            c_size = iniparser_getsecnkeys (ini, "cache");
-        iniparser_dump_ini (ini, db);
-        fclose (db);
-
-        if (c_size != 0)
-            n2a_logger (LG_INFO, "syncing %d messages from cache to disk (into: '%s')",
-                        c_size / 2, g_options.cache_file);
-        
-    } else {
-        n2a_logger (LG_CRIT, "CACHE: flush error: %s", strerror (errno));
-    }
+    /* never replace a cache file we failed to load with an empty one */
+    if (ini == NULL)
+        goto reschedule;
+    sync_cache ();
 reschedule:
+    n2a_unlock ();
     now = time (NULL);
 #ifndef DEBUG
     schedule_new_event(EVENT_USER_FUNCTION,
@@ -259,148 +451,257 @@ reschedule:
 #endif
 }
 
+int
+n2a_cache_pending (int broker)
+{
+    return dbsetup && cursor[broker] <= lastid;
+}
+
+int
+n2a_cache_count (void)
+{
+    return dbsetup && lastid >= firstid ? lastid - firstid + 1 : 0;
+}
+
 void
 n2a_record_cache (const char *key, const char *message)
+{
+    n2a_record_cache_pending (key, message, xstrlen (message), N2A_MSG_JSON, NULL, ~0U);
+}
+
+static void
+unset_message (int id)
 {
     char index[256];
-    /* avoid caching the message twice */
-    if (key == tkey && message == tmsg)
+    snprintf (index, 256, "cache:key_%d", id);
+    iniparser_unset (ini, index);
+    snprintf (index, 256, "cache:message_%d", id);
+    iniparser_unset (ini, index);
+    snprintf (index, 256, "format:%d", id);
+    iniparser_unset (ini, index);
+    snprintf (index, 256, "part:%d", id);
+    iniparser_unset (ini, index);
+    rewrite = TRUE;
+}
+
+void
+n2a_record_cache_pending (const char *key, const char *message, size_t len,
+                          int format, const struct n2a_part *part,
+                          unsigned int brokers)
+{
+    char index[256];
+    int i;
+    int b64 = (format & (N2A_MSG_MSGPACK | N2A_MSG_GZIP)) || part != NULL;
+    if (!dbsetup)
         return;
-    int n = iniparser_getsecnkeys (ini, "cache");
-    if ((n / 2) >= g_options.cache_size && n > 0) {
+    /* it would not be read back, and the rest of the file with it */
+    if ((b64 ? (len + 2) / 3 * 4 : len) > N2A_CACHE_VALUE_MAX) {
+        n2a_logger (LG_CRIT, "message too big for the cache, dropping it: '%s' (%lu bytes)",
+                    key, (unsigned long) len);
+        return;
+    }
+    if ((lastid - firstid + 1) >= g_options.cache_size && lastid >= firstid) {
         n2a_logger (LG_CRIT, "cache size exceded! Replacing oldest messages");
-        char **keys = iniparser_getseckeys (ini, "cache");
-        /* sort the returned keys */
-        qsort (keys, (size_t) n, sizeof (char *), compare);
-        char *index_key = keys[0];
-        /* then free the list although the doc says not to... */
-        xfree (keys);
-        char *m = strchr (index_key, '_');
-        int first = strtol (m+1, NULL, 10);
-        snprintf (index, 256, "cache:key_%d", first);
-        iniparser_unset (ini, index);
-        snprintf (index, 256, "cache:message_%d", first);
-        iniparser_unset (ini, index);
-        c_size = n;
-    } else
-        c_size = n + 2;
+        unset_message (firstid);
+        firstid++;
+        for (i = 0; i < N2A_MAX_BROKERS; i++)
+            cursor[i] = xmax (cursor[i], firstid);
+    }
     lastid++;
-    snprintf (index, 256, "cache:key_%d", lastid);
-    iniparser_set (ini, index, key);
+    {
+        char value[16];
+        unsigned int id = n2a_intern (key);
+        snprintf (value, 16, "%u", id);
+        snprintf (index, 256, "keys:%u", id);
+        if (!iniparser_find_entry (ini, index)) {
+            iniparser_set (ini, index, key);
+            new_keys = realloc (new_keys, (nnew_keys + 1) * sizeof (*new_keys));
+            if (new_keys == NULL)
+                err (2, "n2a_record_cache can not allocate a key");
+            new_keys[nnew_keys++] = id;
+        }
+        snprintf (index, 256, "cache:key_%d", lastid);
+        iniparser_set (ini, index, value);
+    }
     snprintf (index, 256, "cache:message_%d", lastid);
-    iniparser_set (ini, index, message);
+    /* a part of a json event may end with a '\\' which iniparser would
+     * take for a line continuation */
+    if (b64) {
+        char *encoded = xbase64_encode (message, len);
+        iniparser_set (ini, index, encoded);
+        xfree (encoded);
+    } else
+        iniparser_set (ini, index, message);
+    /* plain json messages are the common case, only tag the others */
+    if (format != N2A_MSG_JSON) {
+        char value[16];
+        snprintf (index, 256, "format:%d", lastid);
+        snprintf (value, 16, "%d", format);
+        iniparser_set (ini, index, value);
+    }
+    if (part != NULL) {
+        char value[256];
+        snprintf (index, 256, "part:%d", lastid);
+        snprintf (value, 256, "%d %d %s", part->index, part->count, part->id);
+        iniparser_set (ini, index, value);
+    }
+    /* brokers which already got this message skip it */
+    for (i = 0; i < N2A_MAX_BROKERS; i++)
+        if (!(brokers & (1U << i)) && cursor[i] == lastid)
+            cursor[i] = lastid + 1;
     n2a_logger (LG_DEBUG, "add message in cache: '%s' (%d)", key, lastid);
 }
 
-void
-n2a_pop_all_cache (void *pf)
+/**
+ * drop the messages every broker already received
+ */
+static void
+trim_cache (void)
 {
-    time_t now = 0;
-    unsigned int force = *(int *)pf;
-    unsigned int f = FALSE;
-
-    if (!amqp_connected)
-        amqp_connect ();
-
-    if (!amqp_connected)
-        goto reschedule;
-
-    if (pop_lock)
-        goto reschedule;
-
-    if (g_options.autoflush < 0 && !force)
-        goto reschedule;
-
-    if (g_options.autoflush == 0)
-        goto do_it;
-
-    now = time (NULL);
-    if ((int) difftime (now, last_pop) < g_options.autoflush && !force)
-        goto reschedule;
+    int i, min = lastid + 1;
+    for (i = 0; i < n2a_broker_count (); i++)
+        min = xmin (min, cursor[i]);
+    for (; firstid < min; firstid++)
+        unset_message (firstid);
+    if (firstid > lastid) {
+        firstid = 1;
+        lastid = 0;
+        for (i = 0; i < N2A_MAX_BROKERS; i++)
+            cursor[i] = 1;
+    }
+}
 
-do_it:
-    last_pop = now;
-    int r = 0;
-    c_size = iniparser_getsecnkeys (ini, "cache");
-    int storm, cpt = 0;
+int
+n2a_depile_cache (int broker)
+{
+    int pending = lastid - cursor[broker] + 1;
+    int storm, cpt = 0, r;
     size_t l;
     char convert[128];
-    if ((c_size / 2) <= 0)
-        goto reschedule;
-    if (purge_cache) {
-        purge_cache = FALSE;
-        storm = c_size / 2;
+
+    if (!dbsetup || pop_lock || pending <= 0)
+        return 0;
+
+    /* shutting down: no anti-storm, the deadline bounds it */
+    if ((purge_cache & (1U << broker)) || n2a_draining ()) {
+        purge_cache &= ~(1U << broker);
+        storm = pending;
         goto proceed;
     }
     if (g_options.flush > 0) {
-        storm = xmin (c_size/2, g_options.flush);
+        storm = xmin (pending, g_options.flush);
         goto proceed;
     }
-    snprintf (convert, 128, "%d", c_size);
+    snprintf (convert, 128, "%d", pending * 2);
     /* in order to avoid flush storming the AMQP bus, evaluate the number of
      * messages to flush */
     switch ((l = xstrlen (convert))) {
         case 1:
         case 2:
-            storm = c_size/2;
+            storm = pending;
             break;
         case 3:
-            storm = c_size/4;
+            storm = pending/2;
             break;
         case 4:
-            storm = c_size/20;
+            storm = pending/10;
             break;
         case 5:
-            storm = c_size/200;
+            storm = pending/100;
             break;
         default:
-            storm = c_size/(20 * (10^(l-3)));
+            storm = pending/(10 * (10^(l-3)));
             break;
     }
+    storm = xmax (storm, 1);
 proceed:
-    n2a_logger (LG_INFO, "Start to unstack %d/%d messages from cache", storm, c_size/2);
+    n2a_logger (LG_INFO, "Start to unstack %d/%d messages from cache to %s",
+                storm, pending, n2a_broker_name (broker));
 
     pop_lock = TRUE;
-    do {
-        char **keys = iniparser_getseckeys (ini, "cache");
-        /* sort the returned keys */
-        qsort (keys, (size_t) c_size, sizeof (char *), compare);
-        char *index_key = keys[0];
-        /* then free the list although the doc says not to... */
-        xfree (keys);
-        char *m = strchr (index_key, '_');
-        char index_message[256];
-        snprintf (index_message, 256, "cache:message_%s", m+1);
-        ini_lock = TRUE;
-        char *key = iniparser_getstring (ini, index_key, NULL);
+    while (cursor[broker] <= lastid && cpt < storm && !n2a_past_deadline ()) {
+        char index_key[256], index_message[256], index_format[256], index_part[256];
+        snprintf (index_key, 256, "cache:key_%d", cursor[broker]);
+        snprintf (index_message, 256, "cache:message_%d", cursor[broker]);
+        snprintf (index_format, 256, "format:%d", cursor[broker]);
+        snprintf (index_part, 256, "part:%d", cursor[broker]);
+        const char *key = message_key (iniparser_getstring (ini, index_key, NULL));
         char *message = iniparser_getstring (ini, index_message, NULL);
-        tkey = key;
-        tmsg = message;
-        int r = amqp_publish (key, message);
-        ini_lock = FALSE;
+        if (key == NULL || message == NULL) {
+            cursor[broker]++;
+            continue;
+        }
+        int format = iniparser_getint (ini, index_format, N2A_MSG_JSON);
+        char *value = iniparser_getstring (ini, index_part, NULL);
+        struct n2a_part part, *ppart = NULL;
+        char id[256];
+        if (value != NULL
+            && sscanf (value, "%d %d %255s", &part.index, &part.count, id) == 3) {
+            part.id = id;
+            ppart = &part;
+        }
+        char *body = message;
+        size_t len = 0;
+        if ((format & (N2A_MSG_MSGPACK | N2A_MSG_GZIP)) || ppart != NULL)
+            body = xbase64_decode (message, &len);
+        else
+            len = xstrlen (message);
+        if (body == NULL) {
+            n2a_logger (LG_CRIT, "dropping corrupted message from cache '%s'", key);
+            cursor[broker]++;
+            continue;
+        }
+        r = n2a_broker_publish (broker, key, body, len, format, ppart);
+        if (body != message)
+            xfree (body);
         if (r < 0) {
             n2a_logger (LG_CRIT, "error while stacking message from cache '%s'", key);
             break;
         }
-        iniparser_unset (ini, index_key);
-        iniparser_unset (ini, index_message);
+        cursor[broker]++;
         cpt++;
         n2a_logger (LG_DEBUG, "cache successfuly purged from message '%s' (%d/%d)",
                    index_message, cpt, storm);
-        if (cpt >= storm)
-            break;
-        usleep (g_options.rate);
-    } while (r == 0 && ((c_size = iniparser_getsecnkeys (ini, "cache")) / 2) > 0);
+        if (cpt < storm && !n2a_draining ())
+            usleep (g_options.rate);
+    }
     pop_lock = FALSE;
-    if (r == 0 && (c_size / 2) == 0)
-        lastid = 0;
-    if (cpt >= storm)
-        c_size = iniparser_getsecnkeys (ini, "cache");
-    if (c_size / 2 != 0)
-        n2a_logger (LG_INFO, "Done, %d messages sent, there is still %d messages in cache", cpt, c_size / 2);
+    pending = lastid - cursor[broker] + 1;
+    trim_cache ();
+    if (pending > 0)
+        n2a_logger (LG_INFO, "Done, %d messages sent, there is still %d messages in cache", cpt, pending);
     else
         n2a_logger (LG_INFO, "Done, %d messages sent, no more messages in cache", cpt);
+    return cpt;
+}
+
+void
+n2a_pop_all_cache (void *pf)
+{
+    time_t now = 0;
+    unsigned int force = *(int *)pf;
+    unsigned int f = FALSE;
+    int i;
+
+    n2a_lock ();
+    if (g_options.autoflush < 0 && !force)
+        goto reschedule;
+
+    if (g_options.autoflush == 0)
+        goto do_it;
+
+    now = time (NULL);
+    if ((int) difftime (now, last_pop) < g_options.autoflush && !force)
+        goto reschedule;
+
+do_it:
+    last_pop = now;
+    for (i = 0; i < n2a_broker_count (); i++) {
+        if (n2a_broker_connect (i))
+            n2a_depile_cache (i);
+    }
 reschedule:
+    n2a_unlock ();
     last_pop = time (NULL);
 #ifdef DEBUG
     alarm (g_options.autoflush);
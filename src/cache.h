@@ -17,6 +17,18 @@
 # along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
 # ---------------------------------*/
 
+#include "neb2amqp.h"
+
+/**
+ * iniparser reads lines of at most 10240 bytes (ASCIILINESZ) and gives up
+ * on the whole file past that. a cached message is one 'message_<id> = '
+ * line, so its value is kept under this, with room for the key.
+ */
+#define N2A_CACHE_VALUE_MAX (10240 - 64)
+
+/* the biggest 'max_size' whose parts, base64 encoded, fit in the cache */
+#define N2A_CACHE_MAX_SIZE (N2A_CACHE_VALUE_MAX / 4 * 3)
+
 /* this functions clears the neb cache */
 void n2a_clear_cache (void);
 
@@ -41,6 +53,32 @@ void n2a_flush_cache (void *pf);
  */
 void n2a_record_cache (const char *key, const char *message);
 
+/**
+ * same as n2a_record_cache but the message is only queued for the brokers
+ * set in the 'brokers' bitmask, the others already received it.
+ * 'format' (N2A_MSG_*) is kept so the message is resent with the same
+ * content type, binary messages are stored in base64. 'part' (or NULL)
+ * keeps the headers of a part of a chunked event.
+ */
+void n2a_record_cache_pending (const char *key, const char *message, size_t len,
+                               int format, const struct n2a_part *part,
+                               unsigned int brokers);
+
+/* returns TRUE if some cached messages still have to be sent to 'broker' */
+int n2a_cache_pending (int broker);
+
+/* number of messages in the cache, sent to some brokers or not */
+int n2a_cache_count (void);
+
+/**
+ * this function resends to one broker the cached messages it did not get
+ * yet, at most the 'flush' amount (or the computed anti-storm amount).
+ * while draining on shutdown, everything until the deadline.
+ * note: when one send fails, we stop the depiling process until next time...
+ * @return the number of messages sent
+ */
+int n2a_depile_cache (int broker);
+
 /**
  * this function depiles the messages already stored in memory and resent them
  * to the AMQP bus.
@@ -0,0 +1,71 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include <string.h>
+#include <zlib.h>
+
+#include "nagios.h"
+#include "logger.h"
+#include "xutils.h"
+#include "module.h"
+#include "compress.h"
+
+extern struct options g_options;
+
+int
+n2a_compress_wanted (size_t len)
+{
+    return g_options.compress > 0 && (int) len >= g_options.compress
+        && g_options.transport == N2A_TRANSPORT_AMQP;
+}
+
+char *
+n2a_compress (const char *in, size_t len, size_t *zlen)
+{
+    z_stream zs;
+    char *out;
+    /* deflateBound() does not account for the gzip header and trailer */
+    size_t bound;
+
+    memset (&zs, 0, sizeof (zs));
+    /* 15 + 16: default window with a gzip wrapper, so consumers can use
+     * any stock gunzip */
+    if (deflateInit2 (&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                      Z_DEFAULT_STRATEGY) != Z_OK) {
+        n2a_logger (LG_ERR, "COMPRESS: %s", zs.msg ? zs.msg : "deflateInit2 failed");
+        return NULL;
+    }
+
+    bound = deflateBound (&zs, len) + 18;
+    out = xmalloc (bound);
+    zs.next_in = (Bytef *) in;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *) out;
+    zs.avail_out = bound;
+
+    if (deflate (&zs, Z_FINISH) != Z_STREAM_END || zs.total_out >= len) {
+        deflateEnd (&zs);
+        xfree (out);
+        return NULL;
+    }
+
+    *zlen = zs.total_out;
+    deflateEnd (&zs);
+    return out;
+}
@@ -0,0 +1,42 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef compress_h
+#define compress_h
+
+#include <stddef.h>
+
+/**
+ * gzip a message body.
+ * @param in: buffer to compress
+ * @param len: size of 'in'
+ * @param zlen: set to the size of the returned buffer
+ * @return a newly allocated buffer to xfree, or NULL if compressing failed
+ * or did not make the message smaller
+ */
+char *n2a_compress (const char *in, size_t len, size_t *zlen);
+
+/**
+ * TRUE if a body of 'len' bytes is to be gzipped: 'compress' is set, the
+ * body reaches it, and the transport can tell the consumer (the relay
+ * records carry no content encoding).
+ */
+int n2a_compress_wanted (size_t len);
+
+#endif
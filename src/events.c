@@ -21,100 +21,174 @@
 #include "module.h"
 #include "logger.h"
 #include "xutils.h"
+#include "compress.h"
 
 #include "json.h"
 #include "neb2amqp.h"
 #include "xutils.h"
 
 #include "events.h"
+#include "worker.h"
+#include "filter.h"
+#include "shed.h"
+#include "batch.h"
 
 extern struct options g_options;
-extern int c_size;
 
 int g_last_event_program_status = 0;
 
-// Define a macro that will handle the split of messages
-#define split_message(message,field)                                               \
-do {                                                                               \
-    temp = ((int)xstrlen(message)/left + 1);                                       \
-    i = 0;                                                                         \
-    while (i < temp) {                                                             \
-        nebstruct_service_check_data_update_json(&jdata, message, field, left, i); \
-        char *json = json_dumps(jdata, 0);                                         \
-        size_t len = xstrlen (json);                                               \
-        buffer = xmalloc (len + 1);                                                \
-        snprintf (buffer, len + 1, "%s", json);                                    \
-        if (c_size == -10000 || c_size / 2 == 0)                                   \
-            amqp_publish(key, buffer);                                             \
-        else                                                                       \
-            n2a_record_cache (key, buffer);                                        \
-        xfree(buffer);                                                             \
-        xfree (json);                                                              \
-        i++;                                                                       \
-    }                                                                              \
-} while(0);
+static long
+elapsed_us (const struct timeval *start)
+{
+  struct timeval now;
+  gettimeofday (&now, NULL);
+  return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_usec - start->tv_usec);
+}
+
+void
+n2a_publish_service_check (nebstruct_service_check_data *c,
+                           const struct n2a_meta *meta, int suppressed)
+{
+  char *buffer = NULL;
+
+  /* routing key and constant fields are built once per service */
+  struct n2a_object *o = n2a_service_object(c, meta);
+  const char *key = o->key;
+
+  int snapshot = (suppressed == N2A_SNAPSHOT);
+
+  /* carried over if 'changes_only' drops this one too */
+  if (!snapshot)
+      o->suppressed += suppressed;
+  else
+      o->since_full = 0;
+
+  if (g_options.changes_only && !snapshot
+      && !n2a_object_changed(o, c->state, c->state_type, c->output, c->timestamp.tv_sec))
+    return;
+
+  json_t *jdata = NULL;
+  size_t message_size = 0;
+
+  int nbmsg = nebstruct_service_check_data_to_json(c, o, &jdata, &message_size); 
 
+  if (nbmsg == 1) {
+      buffer = n2a_event_encode(o, jdata, message_size);
+
+      if (snapshot)
+          n2a_batch_add(key, buffer, message_size);
+      else
+          amqp_publish(key, buffer, message_size);
+
+      xfree(buffer);
+  } else {
+      /* too big: encode the whole event once, compressed if it helps,
+       * and slice the result if it still does not fit */
+      size_t len = message_size, zlen = 0;
+      int format = g_options.encoding;
+      char *zipped = NULL;
+
+      buffer = n2a_event_encode(o, jdata, len);
+
+      if (n2a_compress_wanted(len)
+          && (zipped = n2a_compress(buffer, len, &zlen)) != NULL) {
+          xfree(buffer);
+          buffer = zipped;
+          len = zlen;
+          format |= N2A_MSG_GZIP;
+      }
+
+      if ((int)len <= g_options.max_size) {
+          amqp_publish_format(key, buffer, len, format);
+      } else {
+          n2a_logger(LG_INFO, "Data too long... sending %d parts for host: %s, service: %s",
+                     (int)((len + g_options.max_size - 1) / g_options.max_size),
+                     c->host_name, c->service_description);
+          amqp_publish_parts(key, buffer, len, format);
+      }
+
+      xfree(buffer);
+  }
+
+  if (jdata != NULL)
+      json_decref (jdata);
+  o->suppressed = 0;
+}
 
 int
 n2a_event_service_check (int event_type __attribute__ ((__unused__)), void *data)
 {
   //logger(LG_DEBUG, "Event: event_host_check");
   nebstruct_service_check_data *c = (nebstruct_service_check_data *) data;
+  nebstruct_service_check_data copy;
+  struct timeval start;
+  int suppressed = 0;
+
+  if (c->type != NEBTYPE_SERVICECHECK_PROCESSED)
+    return 0;
 
-  if (c->type == NEBTYPE_SERVICECHECK_PROCESSED)
+  if (n2a_shed_enabled ())
+    gettimeofday (&start, NULL);
+
+  if (n2a_filter_service (c, &suppressed))
     {
       //logger(LG_DEBUG, "SERVICECHECK_PROCESSED: %s->%s", c->host_name, c->service_description);
-      char *buffer = NULL, *key = NULL;
-
-      size_t l = xstrlen(g_options.connector) +
-      xstrlen(g_options.eventsource_name) + xstrlen(c->host_name) + xstrlen(c->service_description) + 20;
-      // "..check.ressource.." + \0 = 20 chars
+      if (!n2a_sample_service (c) || n2a_shed_level () >= N2A_SHED_PERFDATA)
+        {
+          /* the other modules get the same structure, work on a copy */
+          copy = *c;
+          copy.perf_data = "";
+          if (n2a_shed_level () >= N2A_SHED_PERFDATA)
+            copy.long_output = "";
+          c = &copy;
+        }
+      if (n2a_worker_enabled ())
+          n2a_worker_service_check (c, suppressed);
+      else
+          n2a_publish_service_check (c, n2a_service_meta (c), suppressed);
+    }
 
-      json_t *jdata = NULL;
-      size_t message_size = 0;
+  if (n2a_shed_enabled ())
+    n2a_shed_update (c->latency, elapsed_us (&start), c->timestamp.tv_sec);
 
-      int nbmsg = nebstruct_service_check_data_to_json(c, &jdata, &message_size); 
+  return 0;
+}
 
-      // DO NOT FREE !!!
-      xalloca(key, xmin(g_options.max_size, (int)l) * sizeof(char));
+void
+n2a_publish_host_check (nebstruct_host_check_data *c,
+                        const struct n2a_meta *meta, int suppressed)
+{
+  char *buffer = NULL;
 
-      snprintf(key, xmin(g_options.max_size, (int)l),
-                 "%s.%s.check.resource.%s.%s", g_options.connector,
-                 g_options.eventsource_name, c->host_name,
-                 c->service_description);
+  struct n2a_object *o = n2a_host_object(c, meta);
+  const char *key = o->key;
 
-      if (nbmsg == 1) {
-          char *json = json_dumps(jdata, 0);
-          buffer = xmalloc (message_size + 1);
+  int snapshot = (suppressed == N2A_SNAPSHOT);
 
-          snprintf (buffer, message_size + 1, "%s", json);
+  /* carried over if 'changes_only' drops this one too */
+  if (!snapshot)
+      o->suppressed += suppressed;
+  else
+      o->since_full = 0;
 
-          if (c_size == -10000 || c_size / 2 == 0) 
-              amqp_publish(key, buffer);
-          else
-              n2a_record_cache (key, buffer);
+  if (g_options.changes_only && !snapshot
+      && !n2a_object_changed(o, c->state, c->state_type, c->output, c->timestamp.tv_sec))
+    return;
 
-          xfree(buffer);
-          xfree (json);
-      } else {
-          int left = g_options.max_size - (int)message_size;
-          size_t l_out = xstrlen(c->long_output);
-          size_t out = xstrlen(c->output);
-          size_t perf = xstrlen(c->perf_data);
-          int msgs = ((int)l_out/left + 1) + ((int)out/left + 1) + ((int)perf/left + 1);
-          n2a_logger(LG_INFO, "Data too long... sending %d messages for host: %s, service: %s", msgs, c->host_name, c->service_description);
-          int i, temp;
-          split_message(c->long_output, "long_output");
-          split_message(c->output, "output");
-          split_message(c->perf_data, "perf_data");
-      }
+  size_t len = 0;
+  int format;
 
-      if (jdata != NULL)
-          json_decref (jdata);
+  nebstruct_host_check_data_to_json(&buffer, &len, &format, o, c); 
 
-    }
+  if (format & N2A_MSG_GZIP)
+      amqp_publish_format(key, buffer, len, format);
+  else if (snapshot)
+      n2a_batch_add(key, buffer, len);
+  else
+      amqp_publish(key, buffer, len);
 
-  return 0;
+  xfree(buffer);
+  o->suppressed = 0;
 }
 
 int
@@ -122,31 +196,36 @@ n2a_event_host_check (int event_type __attribute__ ((__unused__)), void *data)
 {
   //logger(LG_DEBUG, "Event: event_service_check");
   nebstruct_host_check_data *c = (nebstruct_host_check_data *) data;
+  nebstruct_host_check_data copy;
+  struct timeval start;
+  int suppressed = 0;
 
-  if (c->type == NEBTYPE_HOSTCHECK_PROCESSED)
-    {
-      //logger(LG_DEBUG, "HOSTCHECK_PROCESSED: %s", c->host_name);
-      char *buffer = NULL, *key = NULL;
-
-      size_t l = xstrlen(g_options.connector) + xstrlen(g_options.eventsource_name) + xstrlen(c->host_name) + 20; 
-
-      nebstruct_host_check_data_to_json(&buffer, c); 
+  if (c->type != NEBTYPE_HOSTCHECK_PROCESSED)
+    return 0;
 
-      // DO NOT FREE !!!
-      xalloca(key, xmin(g_options.max_size, (int)l) * sizeof(char));
+  if (n2a_shed_enabled ())
+    gettimeofday (&start, NULL);
 
-      snprintf(key, xmin(g_options.max_size, (int)l),
-                 "%s.%s.check.component.%s", g_options.connector,
-                 g_options.eventsource_name, c->host_name);
-
-      if (c_size == -10000 || c_size / 2 == 0)
-          amqp_publish(key, buffer);
+  if (n2a_filter_host (c, &suppressed))
+    {
+      //logger(LG_DEBUG, "HOSTCHECK_PROCESSED: %s", c->host_name);
+      if (!n2a_sample_host (c) || n2a_shed_level () >= N2A_SHED_PERFDATA)
+        {
+          copy = *c;
+          copy.perf_data = "";
+          if (n2a_shed_level () >= N2A_SHED_PERFDATA)
+            copy.long_output = "";
+          c = &copy;
+        }
+      if (n2a_worker_enabled ())
+          n2a_worker_host_check (c, suppressed);
       else
-          n2a_record_cache (key, buffer);
-
-      xfree(buffer);
+          n2a_publish_host_check (c, n2a_host_meta (c), suppressed);
     }
 
+  if (n2a_shed_enabled ())
+    n2a_shed_update (c->latency, elapsed_us (&start), c->timestamp.tv_sec);
+
   return 0;
 }
 
@@ -166,20 +245,46 @@ event_process (int event_type __attribute__ ((__unused__)), void *data)
   
   return 0;
 }
+*/
+
+void
+n2a_publish_message (const char *key, const char *message, size_t len)
+{
+  if ((int) len <= g_options.max_size)
+      amqp_publish (key, message, len);
+  else
+      amqp_publish_parts (key, message, len, g_options.encoding);
+}
+
+/* encode an event and send it the way the checks go */
+static void
+forward_event (json_t *jdata, char *key)
+{
+  size_t len = n2a_encoded_size (jdata);
+  char *buffer = n2a_encode (jdata, len);
+
+  json_decref (jdata);
+  if (n2a_worker_enabled ())
+      n2a_worker_message (key, buffer, len);
+  else
+      n2a_publish_message (key, buffer, len);
+  xfree (buffer);
+  xfree (key);
+}
 
 int
 event_program_status (int event_type __attribute__ ((__unused__)), void *data)
 {
   nebstruct_program_status_data *ps = (nebstruct_program_status_data *) data;
+  char *key = NULL;
   //logger(LG_DEBUG, "Event: event_program_status (type: %i)", ps->type);
 
-  //Send program_status every 10sec min
-  if ((int) ps->timestamp.tv_sec >= (g_last_event_program_status + 10))
+  //Send program_status every 'program_status' sec min
+  if (ps->type == NEBTYPE_PROGRAMSTATUS_UPDATE
+      && (int) ps->timestamp.tv_sec >= (g_last_event_program_status + g_options.program_status))
     {
-      char buffer[AMQP_MSG_SIZE_MAX];
-      //TODO
-      //nebstruct_program_status_data_to_json(buffer, ps);
-      //amqp_publish (exchange_name, routingkey, buffer);
+      json_t *jdata = nebstruct_program_status_data_to_json (ps, &key);
+      forward_event (jdata, key);
       g_last_event_program_status = (int) ps->timestamp.tv_sec;
     }
   return 0;
@@ -192,16 +297,13 @@ event_acknowledgement (int event_type
 {
   //logger(LG_DEBUG, "Event: event_acknowledgement");
   nebstruct_acknowledgement_data *c = (nebstruct_acknowledgement_data *) data;
+  char *key = NULL;
   
   if (c->type == NEBTYPE_ACKNOWLEDGEMENT_ADD)
     {
       n2a_logger(LG_DEBUG, "Event: event_acknowledgement ADD");
-
-      char buffer[AMQP_MSG_SIZE_MAX];
-      //TODO
-      //nebstruct_acknowledgement_data_to_json(buffer, c);
-      //amqp_publish (exchange_name, routingkey, buffer);
-
+      json_t *jdata = nebstruct_acknowledgement_data_to_json (c, &key);
+      forward_event (jdata, key);
     }
   else if (c->type == NEBTYPE_ACKNOWLEDGEMENT_REMOVE)
     {
@@ -217,22 +319,15 @@ event_downtime (int event_type __attribute__ ((__unused__)), void *data)
 {
   //logger(LG_DEBUG, "Event: event_downtime");
   nebstruct_downtime_data *c = (nebstruct_downtime_data *) data;
+  char *key = NULL;
   
-  if (c->type == NEBTYPE_DOWNTIME_START)
+  /* NEBTYPE_DOWNTIME_LOAD replays the retained downtimes at startup */
+  if (c->type == NEBTYPE_DOWNTIME_ADD || c->type == NEBTYPE_DOWNTIME_DELETE
+      || c->type == NEBTYPE_DOWNTIME_START || c->type == NEBTYPE_DOWNTIME_STOP)
     {
-      n2a_logger(LG_DEBUG, "Event: event_downtime START");
-    }
-  else if (c->type == NEBTYPE_DOWNTIME_STOP)
-    {
-      n2a_logger(LG_DEBUG, "Event: event_downtime STOP");
-    }
-
-  if (c->type == NEBTYPE_DOWNTIME_START || c->type == NEBTYPE_DOWNTIME_STOP)
-    {
-      char buffer[AMQP_MSG_SIZE_MAX];
-      //TODO
-      //nebstruct_downtime_data_to_json(buffer, c);
-      //amqp_publish (exchange_name, routingkey, buffer);
+      n2a_logger(LG_DEBUG, "Event: event_downtime %d", c->type);
+      json_t *jdata = nebstruct_downtime_data_to_json (c, &key);
+      forward_event (jdata, key);
     }
 
   return 0;
@@ -243,24 +338,32 @@ event_comment (int event_type __attribute__ ((__unused__)), void *data)
 {
   //logger(LG_DEBUG, "Event: event_comment");
   nebstruct_comment_data *c = (nebstruct_comment_data *) data;
+  char *key = NULL;
   
-  if (c->type == NEBTYPE_COMMENT_ADD)
-    {
-      n2a_logger(LG_DEBUG, "Event: event_comment ADD");
-    }
-  else if (c->type == NEBTYPE_COMMENT_DELETE)
+  if (c->type == NEBTYPE_COMMENT_ADD || c->type == NEBTYPE_COMMENT_DELETE)
     {
-      n2a_logger(LG_DEBUG, "Event: event_comment DELETE");
+      n2a_logger(LG_DEBUG, "Event: event_comment %s",
+                 c->type == NEBTYPE_COMMENT_ADD ? "ADD" : "DELETE");
+      json_t *jdata = nebstruct_comment_data_to_json (c, &key);
+      forward_event (jdata, key);
     }
 
-  if (c->type == NEBTYPE_COMMENT_ADD || c->type == NEBTYPE_COMMENT_DELETE)
+  return 0;
+}
+
+/* CHANGE_CUSTOM_*_VAR replaces the values read by the metadata */
+int
+n2a_event_external_command (int event_type __attribute__ ((__unused__)), void *data)
+{
+  nebstruct_external_command_data *c = (nebstruct_external_command_data *) data;
+
+  if (c->type == NEBTYPE_EXTERNALCOMMAND_END
+      && (c->command_type == CMD_CHANGE_CUSTOM_HOST_VAR
+          || c->command_type == CMD_CHANGE_CUSTOM_SVC_VAR))
     {
-      char buffer[AMQP_MSG_SIZE_MAX];
-      //TODO
-      //nebstruct_comment_data_to_json(buffer, c);
-      //amqp_publish (exchange_name, routingkey, buffer);
+      n2a_logger(LG_DEBUG, "Event: custom variable changed, dropping the metadata");
+      n2a_clear_meta ();
     }
 
   return 0;
 }
-*/
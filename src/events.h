@@ -28,8 +28,26 @@ int event_program_status(int event_type __attribute__ ((__unused__)), void *data
 int n2a_event_service_check(int event_type __attribute__ ((__unused__)), void *data);
 int n2a_event_host_check(int event_type __attribute__ ((__unused__)), void *data);
 
+/* encode and publish one check, from the callbacks or the worker thread.
+ * 'suppressed' is the number of checks of the object dropped by the rate
+ * limit since the previous one, or N2A_SNAPSHOT for a state published by
+ * the snapshot: always sent, and as a full event with 'delta' */
+#define N2A_SNAPSHOT -1
+
+struct n2a_meta;
+
+/* 'meta' is the object's metadata, looked up on the nagios thread */
+void n2a_publish_service_check(nebstruct_service_check_data *c,
+                               const struct n2a_meta *meta, int suppressed);
+void n2a_publish_host_check(nebstruct_host_check_data *c,
+                            const struct n2a_meta *meta, int suppressed);
+
+/* publish an encoded event, in parts if it is bigger than 'max_size' */
+void n2a_publish_message(const char *key, const char *message, size_t len);
+
 int event_acknowledgement(int event_type __attribute__ ((__unused__)), void *data);
 int event_downtime(int event_type __attribute__ ((__unused__)), void *data);
 int event_comment(int event_type __attribute__ ((__unused__)), void *data);
+int n2a_event_external_command(int event_type __attribute__ ((__unused__)), void *data);
 
 #endif
@@ -0,0 +1,642 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include "nagios.h"
+#include "logger.h"
+#include "xutils.h"
+#include "module.h"
+#include "json.h"
+#include "filter.h"
+#include "shed.h"
+
+#include <regex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern struct options g_options;
+
+#define N2A_FIELD_HOST      0
+#define N2A_FIELD_SERVICE   1
+#define N2A_FIELD_COMMAND   2
+#define N2A_FIELD_HOSTGROUP 3
+#define N2A_FIELD_STATE     4
+
+#define N2A_ALL_STATES 0xff
+#define N2A_STATES 8
+
+/* no 'limit_rule' applies, 'limit'/'burst' do */
+#define N2A_DEFAULT_LIMIT 0xff
+/* no 'perfdata_sample' applies, perf_data is always kept */
+#define N2A_NO_SAMPLE 0xff
+
+static const char *fields[] = { "host", "service", "command", "hostgroup", "state" };
+static const char *service_states[] = { "ok", "warning", "critical", "unknown" };
+static const char *host_states[] = { "up", "down", "unreachable" };
+
+struct n2a_condition
+{
+    int field;
+    regex_t re;
+};
+
+struct n2a_rule
+{
+    struct n2a_condition *conditions;
+    int nconditions;
+    /* states allowed by the 'state' conditions */
+    unsigned int service_mask;
+    unsigned int host_mask;
+    /* 'limit_rule' only: events per minute and bucket size */
+    int rate;
+    int burst;
+    /* 'perfdata_sample' only: keep every Nth perf_data, or one per interval */
+    int every;
+    int interval;
+};
+
+static struct n2a_rule *includes = NULL;
+static int nincludes = 0;
+static struct n2a_rule *excludes = NULL;
+static int nexcludes = 0;
+static struct n2a_rule *limits = NULL;
+static int nlimits = 0;
+static struct n2a_rule *samples = NULL;
+static int nsamples = 0;
+static int uses_hostgroups = FALSE;
+
+/* per object decision: the states for which it is included/excluded */
+struct n2a_verdict
+{
+    const void *ptr;
+    /* copies: nagios hands a fresh command_name to each check */
+    char *host_name;
+    char *service_description;
+    char *command_name;
+    unsigned int include_mask;
+    unsigned int exclude_mask;
+    /* for each state, the 'limit_rule' and 'perfdata_sample' which apply */
+    unsigned char limit[N2A_STATES];
+    unsigned char sample[N2A_STATES];
+    /* token bucket, in thousandths of an event, refilled on use */
+    uint32_t tokens;
+    uint32_t last_ms;
+    uint32_t suppressed;
+    /* published checks and time of the last perf_data kept, for the sampling */
+    uint32_t sample_count;
+    uint32_t sample_last;
+    /* last published state, for the load shedding */
+    signed char last_state;
+    signed char last_state_type;
+    struct n2a_verdict *next;
+};
+
+static struct n2a_verdict **table = NULL;
+static size_t table_size = 0;
+static size_t table_count = 0;
+
+/* glob to anchored extended regex */
+static char *
+glob_to_regex (const char *glob)
+{
+    char *re = xmalloc (2 * strlen (glob) + 3), *p = re;
+    int in_class = FALSE;
+
+    *p++ = '^';
+    for (; *glob; glob++) {
+        if (in_class) {
+            *p++ = *glob;
+            in_class = (*glob != ']');
+        } else if (*glob == '*') {
+            *p++ = '.';
+            *p++ = '*';
+        } else if (*glob == '?') {
+            *p++ = '.';
+        } else if (*glob == '[') {
+            *p++ = '[';
+            in_class = TRUE;
+        } else {
+            if (strchr (".^$+(){}|\\", *glob))
+                *p++ = '\\';
+            *p++ = *glob;
+        }
+    }
+    *p++ = '$';
+    *p = '\0';
+    return re;
+}
+
+static int
+compile_rule (struct n2a_rule *rule, const char *text)
+{
+    char *copy = xstrdup (text), *cur = copy, *cond;
+    int i;
+
+    rule->conditions = NULL;
+    rule->nconditions = 0;
+    rule->service_mask = rule->host_mask = N2A_ALL_STATES;
+
+    while (cur != NULL && (cond = n2a_next_token (&cur, ',')) != NULL) {
+        char *pattern = strchr (cond, ':'), *re;
+        struct n2a_condition *c;
+        int field = -1, r;
+
+        if (pattern != NULL)
+            *pattern++ = '\0';
+        for (i = 0; pattern != NULL && i < (int) (sizeof (fields) / sizeof (*fields)); i++)
+            if (strcmp (cond, fields[i]) == 0)
+                field = i;
+        if (field < 0) {
+            n2a_logger (LG_ERR, "Invalid filter condition '%s' in '%s'", cond, text);
+            goto error;
+        }
+
+        re = (*pattern == '~') ? xstrdup (pattern + 1) : glob_to_regex (pattern);
+        rule->conditions = realloc (rule->conditions,
+                                    (rule->nconditions + 1) * sizeof (*c));
+        if (rule->conditions == NULL)
+            err (2, "n2a_init_filter can not allocate a condition");
+        c = &rule->conditions[rule->nconditions];
+        r = regcomp (&c->re, re ? re : "", REG_EXTENDED | REG_NOSUB);
+        xfree (re);
+        if (r != 0) {
+            n2a_logger (LG_ERR, "Invalid filter pattern '%s' in '%s'", pattern, text);
+            goto error;
+        }
+        c->field = field;
+        rule->nconditions++;
+
+        /* the state of a check is known in advance, match it now */
+        if (field == N2A_FIELD_STATE) {
+            unsigned int mask = 0;
+            for (i = 0; i < 4; i++)
+                if (regexec (&c->re, service_states[i], 0, NULL, 0) == 0)
+                    mask |= 1U << i;
+            rule->service_mask &= mask;
+            mask = 0;
+            for (i = 0; i < 3; i++)
+                if (regexec (&c->re, host_states[i], 0, NULL, 0) == 0)
+                    mask |= 1U << i;
+            rule->host_mask &= mask;
+        } else if (field == N2A_FIELD_HOSTGROUP) {
+            uses_hostgroups = TRUE;
+        }
+    }
+    xfree (copy);
+    return 0;
+
+error:
+    for (i = 0; i < rule->nconditions; i++)
+        regfree (&rule->conditions[i].re);
+    xfree (rule->conditions);
+    xfree (copy);
+    return -1;
+}
+
+static int
+compile_rules (char **texts, int n, struct n2a_rule **rules)
+{
+    int i, count = 0;
+
+    *rules = n > 0 ? xmalloc (n * sizeof (**rules)) : NULL;
+    for (i = 0; i < n; i++)
+        if (compile_rule (&(*rules)[count], texts[i]) == 0)
+            count++;
+    return count;
+}
+
+static int
+compile_limits (char **texts, int n, struct n2a_rule **rules)
+{
+    int i, count = 0;
+
+    *rules = n > 0 ? xmalloc (n * sizeof (**rules)) : NULL;
+    for (i = 0; i < n; i++) {
+        /* <per minute>:<burst>:<rule> */
+        char *rate = texts[i], *burst = strchr (rate, ':'), *rule = NULL;
+        if (burst != NULL)
+            rule = strchr (burst + 1, ':');
+        if (rule == NULL) {
+            n2a_logger (LG_ERR, "Invalid limit rule '%s'", texts[i]);
+            continue;
+        }
+        if (compile_rule (&(*rules)[count], rule + 1) == 0) {
+            (*rules)[count].rate = xmax (0, strtol (rate, NULL, 10));
+            (*rules)[count].burst = xmax (1, strtol (burst + 1, NULL, 10));
+            count++;
+        }
+    }
+    return count;
+}
+
+static int
+compile_samples (char **texts, int n, struct n2a_rule **rules)
+{
+    int i, count = 0;
+
+    *rules = n > 0 ? xmalloc (n * sizeof (**rules)) : NULL;
+    for (i = 0; i < n; i++) {
+        /* <every>:<rule> or <seconds>s:<rule> */
+        char *every = texts[i], *end, *rule = strchr (every, ':');
+        long value = strtol (every, &end, 10);
+        if (rule == NULL || value <= 0 || (end != rule && *end != 's')) {
+            n2a_logger (LG_ERR, "Invalid perfdata sample '%s'", texts[i]);
+            continue;
+        }
+        if (compile_rule (&(*rules)[count], rule + 1) == 0) {
+            (*rules)[count].every = (*end == 's') ? 1 : (int) value;
+            (*rules)[count].interval = (*end == 's') ? (int) value : 0;
+            count++;
+        }
+    }
+    return count;
+}
+
+static void
+free_rules (struct n2a_rule *rules, int n)
+{
+    int i, j;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < rules[i].nconditions; j++)
+            regfree (&rules[i].conditions[j].re);
+        xfree (rules[i].conditions);
+    }
+    xfree (rules);
+}
+
+void
+n2a_init_filter (void)
+{
+    nincludes = compile_rules (g_options.include, g_options.ninclude, &includes);
+    nexcludes = compile_rules (g_options.exclude, g_options.nexclude, &excludes);
+    nlimits = compile_limits (g_options.limit_rule, g_options.nlimit_rule, &limits);
+    nsamples = compile_samples (g_options.perfdata_sample, g_options.nperfdata_sample,
+                                &samples);
+    if (nincludes + nexcludes > 0)
+        n2a_logger (LG_INFO, "filtering checks with %d include and %d exclude rules",
+                    nincludes, nexcludes);
+    if (n2a_limit_enabled ())
+        n2a_logger (LG_INFO, "rate limiting checks to %d/min per object (burst %d), %d limit rules",
+                    g_options.limit, g_options.burst, nlimits);
+    if (nsamples > 0)
+        n2a_logger (LG_INFO, "sampling perf_data with %d rules", nsamples);
+}
+
+static size_t
+hash_ptr (const void *ptr, size_t size)
+{
+    uintptr_t h = (uintptr_t) ptr >> 4;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    return h & (size - 1);
+}
+
+static void
+grow_table (void)
+{
+    size_t size = table_size ? table_size * 2 : 1024, i;
+    struct n2a_verdict **t = xmalloc (size * sizeof (*t));
+    struct n2a_verdict *v, *next;
+
+    memset (t, 0, size * sizeof (*t));
+    for (i = 0; i < table_size; i++)
+        for (v = table[i]; v != NULL; v = next) {
+            next = v->next;
+            v->next = t[hash_ptr (v->ptr, size)];
+            t[hash_ptr (v->ptr, size)] = v;
+        }
+    xfree (table);
+    table = t;
+    table_size = size;
+}
+
+static int
+same (const char *a, const char *b)
+{
+    return strcmp (charnull ((char *) a), charnull ((char *) b)) == 0;
+}
+
+static void
+free_names (struct n2a_verdict *v)
+{
+    xfree (v->host_name);
+    xfree (v->service_description);
+    xfree (v->command_name);
+}
+
+void
+n2a_deinit_filter (void)
+{
+    struct n2a_verdict *v, *next;
+    size_t i;
+
+    for (i = 0; i < table_size; i++)
+        for (v = table[i]; v != NULL; v = next) {
+            next = v->next;
+            free_names (v);
+            xfree (v);
+        }
+    xfree (table);
+    table = NULL;
+    table_size = table_count = 0;
+    free_rules (includes, nincludes);
+    free_rules (excludes, nexcludes);
+    free_rules (limits, nlimits);
+    free_rules (samples, nsamples);
+    includes = excludes = limits = samples = NULL;
+    nincludes = nexcludes = nlimits = nsamples = 0;
+}
+
+static int
+match (regex_t *re, const char *value)
+{
+    return regexec (re, charnull ((char *) value), 0, NULL, 0) == 0;
+}
+
+static int
+match_hostgroups (regex_t *re, host *h)
+{
+    objectlist *l;
+
+    if (h == NULL)
+        return FALSE;
+    for (l = h->hostgroups_ptr; l != NULL; l = l->next)
+        if (l->object_ptr != NULL
+            && match (re, ((hostgroup *) l->object_ptr)->group_name))
+            return TRUE;
+    return FALSE;
+}
+
+/* states for which a rule matches an object, as a mask */
+static unsigned int
+evaluate_rule (struct n2a_rule *rule, const char *host_name,
+               const char *service_description, const char *command_name,
+               host *h)
+{
+    int j, ok = TRUE;
+
+    for (j = 0; ok && j < rule->nconditions; j++) {
+        struct n2a_condition *c = &rule->conditions[j];
+        switch (c->field) {
+            case N2A_FIELD_HOST:
+                ok = match (&c->re, host_name);
+                break;
+            case N2A_FIELD_SERVICE:
+                ok = service_description != NULL
+                    && match (&c->re, service_description);
+                break;
+            case N2A_FIELD_COMMAND:
+                ok = match (&c->re, command_name);
+                break;
+            case N2A_FIELD_HOSTGROUP:
+                ok = match_hostgroups (&c->re, h);
+                break;
+            default:
+                break;
+        }
+    }
+    if (!ok)
+        return 0;
+    return service_description ? rule->service_mask : rule->host_mask;
+}
+
+static unsigned int
+evaluate (struct n2a_rule *rules, int n, const char *host_name,
+          const char *service_description, const char *command_name,
+          host *h)
+{
+    unsigned int mask = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        mask |= evaluate_rule (&rules[i], host_name, service_description,
+                               command_name, h);
+    return mask;
+}
+
+/* TRUE if the bucket of the object has an event left for this state */
+static int
+take_token (struct n2a_verdict *v, int state, const struct timeval *now)
+{
+    int rate = g_options.limit, burst = g_options.burst;
+    uint32_t now_ms = (uint32_t) (now->tv_sec * 1000 + now->tv_usec / 1000);
+    uint64_t tokens;
+
+    if (v->limit[state] != N2A_DEFAULT_LIMIT) {
+        rate = limits[v->limit[state]].rate;
+        burst = limits[v->limit[state]].burst;
+    }
+    if (rate <= 0)
+        return TRUE;
+
+    /* 'rate' events per minute is 'rate' / 60 thousandths per ms */
+    tokens = v->tokens + (uint64_t) (uint32_t) (now_ms - v->last_ms) * rate / 60;
+    if (tokens > (uint64_t) burst * 1000)
+        tokens = (uint64_t) burst * 1000;
+    v->last_ms = now_ms;
+    if (tokens < 1000) {
+        v->tokens = (uint32_t) tokens;
+        return FALSE;
+    }
+    v->tokens = (uint32_t) (tokens - 1000);
+    return TRUE;
+}
+
+/* the first matching rule wins, for each state (0xff when none does) */
+static void
+first_match (unsigned char *which, struct n2a_rule *rules, int n,
+             const char *host_name, const char *service_description,
+             const char *command_name, host *h)
+{
+    int j, s;
+
+    memset (which, 0xff, N2A_STATES);
+    for (j = n - 1; j >= 0; j--) {
+        unsigned int mask = evaluate_rule (&rules[j], host_name, service_description,
+                                           command_name, h);
+        for (s = 0; s < N2A_STATES; s++)
+            if (mask & (1U << s))
+                which[s] = (unsigned char) j;
+    }
+}
+
+/**
+ * the verdict of an object, evaluated if it is new or if its names changed
+ * (an object pointer reused after a reload, a new check command). the names
+ * are compared by value: the command_name of a check is allocated again for
+ * each check, and the snapshot passes yet another one.
+ */
+static struct n2a_verdict *
+find_verdict (const void *ptr, const char *host_name, const char *service_description,
+              const char *command_name, host *h)
+{
+    struct n2a_verdict *v;
+    int moved = TRUE;
+    size_t i;
+
+    if (table_count >= table_size)
+        grow_table ();
+    i = hash_ptr (ptr, table_size);
+    for (v = table[i]; v != NULL; v = v->next)
+        if (v->ptr == ptr)
+            break;
+
+    if (v == NULL) {
+        v = xmalloc (sizeof (*v));
+        memset (v, 0, sizeof (*v));
+        v->ptr = ptr;
+        v->next = table[i];
+        table[i] = v;
+        table_count++;
+    } else {
+        moved = !same (v->host_name, host_name)
+            || !same (v->service_description, service_description);
+        if (!moved && same (v->command_name, command_name))
+            return v;
+    }
+
+    free_names (v);
+    v->host_name = xstrdup (host_name);
+    v->service_description = xstrdup (service_description);
+    v->command_name = xstrdup (command_name);
+    v->include_mask = nincludes == 0 ? N2A_ALL_STATES :
+        evaluate (includes, nincludes, host_name, service_description, command_name, h);
+    v->exclude_mask =
+        evaluate (excludes, nexcludes, host_name, service_description, command_name, h);
+    first_match (v->limit, limits, nlimits, host_name, service_description,
+                 command_name, h);
+    first_match (v->sample, samples, nsamples, host_name, service_description,
+                 command_name, h);
+    /* the same object with another check command keeps its bucket, its
+     * sampling and its last state */
+    if (moved) {
+        v->tokens = UINT32_MAX;
+        v->last_ms = 0;
+        v->suppressed = 0;
+        v->sample_count = 0;
+        v->sample_last = 0;
+        v->last_state = v->last_state_type = -1;
+    }
+    return v;
+}
+
+static int
+filter (const void *ptr, const char *host_name, const char *service_description,
+        const char *command_name, host *h, int state, int state_type,
+        const struct timeval *now, int *suppressed)
+{
+    struct n2a_verdict *v;
+
+    if (suppressed != NULL)
+        *suppressed = 0;
+    if (nincludes + nexcludes == 0 && !n2a_limit_enabled () && !n2a_shed_enabled ())
+        return TRUE;
+
+    v = find_verdict (ptr, host_name, service_description, command_name, h);
+    if (state < 0 || state >= N2A_STATES)
+        state = N2A_STATES - 1;
+    if (!(v->include_mask & (1U << state)) || (v->exclude_mask & (1U << state)))
+        return FALSE;
+    if (suppressed == NULL)
+        return TRUE;
+    if ((n2a_shed_level () >= N2A_SHED_SOFT && state_type == SOFT_STATE)
+        || (n2a_shed_level () >= N2A_SHED_CHANGES
+            && state == v->last_state && state_type == v->last_state_type)
+        || !take_token (v, state, now)) {
+        v->suppressed++;
+        return FALSE;
+    }
+    v->last_state = (signed char) state;
+    v->last_state_type = (signed char) state_type;
+    *suppressed = (int) v->suppressed;
+    v->suppressed = 0;
+    return TRUE;
+}
+
+static int
+sample (const void *ptr, const char *host_name, const char *service_description,
+        const char *command_name, host *h, int state, const struct timeval *now)
+{
+    struct n2a_verdict *v;
+    struct n2a_rule *rule;
+
+    if (nsamples == 0)
+        return TRUE;
+
+    v = find_verdict (ptr, host_name, service_description, command_name, h);
+    if (state < 0 || state >= N2A_STATES)
+        state = N2A_STATES - 1;
+    if (v->sample[state] == N2A_NO_SAMPLE)
+        return TRUE;
+
+    rule = &samples[v->sample[state]];
+    if (rule->interval > 0) {
+        if (v->sample_count++ > 0
+            && (uint32_t) now->tv_sec - v->sample_last < (uint32_t) rule->interval)
+            return FALSE;
+        v->sample_last = (uint32_t) now->tv_sec;
+        return TRUE;
+    }
+    return v->sample_count++ % rule->every == 0;
+}
+
+int
+n2a_limit_enabled (void)
+{
+    return g_options.limit > 0 || nlimits > 0;
+}
+
+int
+n2a_filter_service (nebstruct_service_check_data *c, int *suppressed)
+{
+    host *h = NULL;
+    if (uses_hostgroups && c->object_ptr != NULL)
+        h = ((service *) c->object_ptr)->host_ptr;
+    return filter (c->object_ptr, c->host_name, c->service_description,
+                   c->command_name, h, c->state, c->state_type, &c->timestamp,
+                   suppressed);
+}
+
+int
+n2a_filter_host (nebstruct_host_check_data *c, int *suppressed)
+{
+    host *h = uses_hostgroups ? (host *) c->object_ptr : NULL;
+    return filter (c->object_ptr, c->host_name, NULL,
+                   c->command_name, h, c->state, c->state_type, &c->timestamp,
+                   suppressed);
+}
+
+int
+n2a_sample_service (nebstruct_service_check_data *c)
+{
+    host *h = NULL;
+    if (uses_hostgroups && c->object_ptr != NULL)
+        h = ((service *) c->object_ptr)->host_ptr;
+    return sample (c->object_ptr, c->host_name, c->service_description,
+                   c->command_name, h, c->state, &c->timestamp);
+}
+
+int
+n2a_sample_host (nebstruct_host_check_data *c)
+{
+    host *h = uses_hostgroups ? (host *) c->object_ptr : NULL;
+    return sample (c->object_ptr, c->host_name, NULL,
+                   c->command_name, h, c->state, &c->timestamp);
+}
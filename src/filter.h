@@ -0,0 +1,61 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef filter_h
+#define filter_h
+
+#include "nagios.h"
+
+/**
+ * 'include' / 'exclude' rules, compiled once at init. a rule is a comma
+ * separated list of conditions 'field:pattern' which must all match, with
+ * field one of host, service, command, hostgroup or state (ok, warning,
+ * critical, unknown for services, up, down, unreachable for hosts). the
+ * pattern is a glob, or an extended regex when it starts with '~'.
+ * a check is published when it matches one of the include rules (if any)
+ * and none of the exclude rules. invalid rules are logged and ignored.
+ */
+void n2a_init_filter (void);
+void n2a_deinit_filter (void);
+
+/**
+ * TRUE if the check has to be published. what does not depend on the state
+ * is evaluated once per object, so this is a table lookup and a bit test
+ * for an already seen host/service. the rate limit ('limit', 'burst' and
+ * 'limit_rule') is a token bucket per object; when a check gets through,
+ * 'suppressed' is set to the number of checks it dropped since the last one
+ * (rate limit and load shedding);
+ * with 'suppressed' NULL the rate limit does not apply. only called from
+ * the nagios thread.
+ */
+int n2a_filter_service (nebstruct_service_check_data *c, int *suppressed);
+int n2a_filter_host (nebstruct_host_check_data *c, int *suppressed);
+
+/**
+ * TRUE if the perf_data of a published check has to be kept. with a
+ * matching 'perfdata_sample', only every Nth check or one per interval
+ * keeps it. the state fields are never sampled.
+ */
+int n2a_sample_service (nebstruct_service_check_data *c);
+int n2a_sample_host (nebstruct_host_check_data *c);
+
+/* TRUE if some checks are rate limited, the events then carry 'suppressed' */
+int n2a_limit_enabled (void);
+
+#endif
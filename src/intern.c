@@ -0,0 +1,170 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include "xutils.h"
+#include "intern.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct n2a_string
+{
+    char *str;
+    unsigned int id;
+    struct n2a_string *next;
+};
+
+/* string -> entry */
+static struct n2a_string **buckets = NULL;
+static size_t nbuckets = 0;
+static size_t count = 0;
+/* id -> entry */
+static struct n2a_string **ids = NULL;
+static size_t nids = 0;
+static unsigned int nextid = 1;
+
+static size_t
+hash_str (const char *str)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261U;
+    for (; *str; str++) {
+        h ^= (unsigned char) *str;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static void
+grow_buckets (void)
+{
+    size_t size = nbuckets ? nbuckets * 2 : 1024, i;
+    struct n2a_string **b = xmalloc (size * sizeof (*b));
+    struct n2a_string *s, *next;
+
+    memset (b, 0, size * sizeof (*b));
+    for (i = 0; i < nbuckets; i++)
+        for (s = buckets[i]; s != NULL; s = next) {
+            next = s->next;
+            s->next = b[hash_str (s->str) & (size - 1)];
+            b[hash_str (s->str) & (size - 1)] = s;
+        }
+    xfree (buckets);
+    buckets = b;
+    nbuckets = size;
+}
+
+static struct n2a_string *
+lookup (const char *str)
+{
+    struct n2a_string *s;
+
+    if (nbuckets == 0)
+        return NULL;
+    for (s = buckets[hash_str (str) & (nbuckets - 1)]; s != NULL; s = s->next)
+        if (strcmp (s->str, str) == 0)
+            return s;
+    return NULL;
+}
+
+static void
+insert (const char *str, unsigned int id)
+{
+    struct n2a_string *s = xmalloc (sizeof (*s));
+    size_t h;
+
+    if (count >= nbuckets)
+        grow_buckets ();
+    if (id >= nids) {
+        size_t size = nids ? nids : 1024;
+        while (size <= id)
+            size *= 2;
+        ids = realloc (ids, size * sizeof (*ids));
+        if (ids == NULL)
+            err (2, "n2a_intern can not allocate %lu bytes",
+                 (u_long) (size * sizeof (*ids)));
+        memset (ids + nids, 0, (size - nids) * sizeof (*ids));
+        nids = size;
+    }
+
+    s->str = xstrdup (str);
+    s->id = id;
+    h = hash_str (str) & (nbuckets - 1);
+    s->next = buckets[h];
+    buckets[h] = s;
+    ids[id] = s;
+    count++;
+    if (id >= nextid)
+        nextid = id + 1;
+}
+
+unsigned int
+n2a_intern (const char *str)
+{
+    struct n2a_string *s;
+
+    if (str == NULL || *str == '\0')
+        return 0;
+    if ((s = lookup (str)) != NULL)
+        return s->id;
+    insert (str, nextid);
+    return nextid - 1;
+}
+
+unsigned int
+n2a_intern_id (const char *str, unsigned int id)
+{
+    struct n2a_string *s;
+
+    if (str == NULL || *str == '\0' || id == 0)
+        return 0;
+    if ((s = lookup (str)) != NULL)
+        return s->id == id ? id : 0;
+    if (n2a_intern_string (id) != NULL)
+        return 0;
+    insert (str, id);
+    return id;
+}
+
+const char *
+n2a_intern_string (unsigned int id)
+{
+    if (id == 0 || id >= nids || ids[id] == NULL)
+        return NULL;
+    return ids[id]->str;
+}
+
+void
+n2a_clear_intern (void)
+{
+    size_t i;
+
+    for (i = 0; i < nids; i++)
+        if (ids[i] != NULL) {
+            xfree (ids[i]->str);
+            xfree (ids[i]);
+        }
+    xfree (ids);
+    xfree (buckets);
+    ids = NULL;
+    buckets = NULL;
+    nids = nbuckets = count = 0;
+    nextid = 1;
+}
@@ -0,0 +1,45 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef intern_h
+#define intern_h
+
+/**
+ * interning table of the routing keys: each distinct string is stored once
+ * and known by a 4 bytes id (ids start at 1, 0 means none). the object
+ * cache points to the interned keys and the disk cache only records the
+ * ids of its messages.
+ */
+
+/* id of 'str', added to the table if needed */
+unsigned int n2a_intern (const char *str);
+
+/**
+ * add 'str' with a given id, as read back from the disk cache.
+ * returns 'id', or 0 if the id or the string is already known otherwise
+ */
+unsigned int n2a_intern_id (const char *str, unsigned int id);
+
+/* interned string of 'id', NULL if unknown */
+const char *n2a_intern_string (unsigned int id);
+
+/* free the whole table, on deinit */
+void n2a_clear_intern (void);
+
+#endif
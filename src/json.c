@@ -17,6 +17,9 @@
 # along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
 # ---------------------------------*/
 
+#include <string.h>
+#include <sys/time.h>
+
 #include "nagios.h"
 #include "module.h"
 #include "logger.h"
@@ -24,6 +27,12 @@
 
 #include "jansson.h"
 #include "xutils.h"
+#include "msgpack.h"
+#include "perfdata.h"
+#include "compress.h"
+#include "neb2amqp.h"
+#include "json.h"
+#include "filter.h"
 
 extern struct options g_options;
 
@@ -37,74 +46,294 @@ charnull (char *data)
   return data;
 }
 
-void
-nebstruct_service_check_data_update_json(json_t **pdata, 
-                                         const char *message, 
-                                         const char *field, 
-                                         int size, 
-                                         int cpt)
+struct n2a_output
+{
+  char *p;
+  char *end;
+  /* leading bytes of the encoder output to drop */
+  size_t skip;
+};
+
+static int
+copy_bytes (const char *buffer, size_t size, void *data)
 {
-  json_t *item;
-  json_t *jdata = *pdata;
+  struct n2a_output *out = data;
+  size_t n = xmin ((int) out->skip, (int) size);
+  out->skip -= n;
+  buffer += n;
+  size -= n;
+  if (size > (size_t) (out->end - out->p))
+    return -1;
+  memcpy (out->p, buffer, size);
+  out->p += size;
+  return 0;
+}
 
-  char *temp = NULL;
-  int offset = cpt * (size - 1); // avoid the final \0 from previous snprintf
+/* quotes plus jansson's escaping (non-ASCII is kept as UTF-8) */
+static size_t
+json_string_size (const char *str)
+{
+  const unsigned char *p;
+  size_t size = 2;
 
-  xalloca (temp, size);
+  for (p = (const unsigned char *) str; *p; p++)
+    {
+      switch (*p)
+        {
+          case '"': case '\\': case '\b': case '\f':
+          case '\n': case '\r': case '\t':
+            size += 2;
+            break;
+          default:
+            size += (*p < 0x20) ? 6 : 1;
+        }
+    }
+  return size;
+}
+
+static size_t
+json_integer_size (json_int_t value)
+{
+  size_t size = 1;
+  /* unsigned, so that the smallest value does not overflow */
+  unsigned long long v = value < 0 ? 0ULL - (unsigned long long) value
+                                   : (unsigned long long) value;
+
+  if (value < 0)
+    size++;
+  while (v >= 10)
+    {
+      v /= 10;
+      size++;
+    }
+  return size;
+}
 
-  snprintf (temp, size, "%s", message+offset);
+/* jansson prints reals with "%.17g", adds ".0" when it looks like an
+ * integer and strips the '+' and the leading zeros of the exponent */
+static size_t
+json_real_size (double value)
+{
+  char buffer[64];
+  const char *start, *end;
+  size_t len = snprintf (buffer, sizeof (buffer), "%.17g", value);
+
+  if ((start = strchr (buffer, 'e')) == NULL)
+    return strchr (buffer, '.') ? len : len + 2;
+
+  start++;
+  end = start + 1;
+  if (*start == '-')
+    start++;
+  while (*end == '0')
+    end++;
+  return len - (end - start);
+}
 
-//  printf ("offset: %d, sending: %s\n", offset, temp);
+/* what json_dump_callback (json, ..., 0) writes, added up value by value */
+static size_t
+json_size (json_t *json)
+{
+  size_t size, n;
+  void *iter;
 
-  json_object_del(jdata, field);
-  item = json_string(temp);
-  json_object_set(jdata, field, item);
-  json_decref(item);
+  switch (json_typeof (json))
+    {
+      case JSON_OBJECT:
+        /* '{' '"key": value' (', ' '"key": value')* '}' */
+        for (size = 2, n = 0, iter = json_object_iter (json); iter;
+             iter = json_object_iter_next (json, iter), n++)
+          size += json_string_size (json_object_iter_key (iter)) + 2
+            + json_size (json_object_iter_value (iter));
+        return size + (n > 1 ? (n - 1) * 2 : 0);
+      case JSON_ARRAY:
+        for (size = 2, n = 0; n < json_array_size (json); n++)
+          size += json_size (json_array_get (json, n));
+        return size + (n > 1 ? (n - 1) * 2 : 0);
+      case JSON_STRING:
+        return json_string_size (json_string_value (json));
+      case JSON_INTEGER:
+        return json_integer_size (json_integer_value (json));
+      case JSON_REAL:
+        return json_real_size (json_real_value (json));
+      case JSON_FALSE:
+        return 5;
+      default:
+        /* true, null */
+        return 4;
+    }
+}
+
+size_t
+n2a_encoded_size (json_t *jdata)
+{
+  if (g_options.encoding == N2A_MSG_MSGPACK)
+    return n2a_msgpack_size (jdata);
+  return json_size (jdata);
+}
+
+size_t
+n2a_string_size (const char *str)
+{
+  str = charnull ((char *) str);
+
+  if (g_options.encoding == N2A_MSG_MSGPACK)
+    return n2a_msgpack_str_size (strlen (str));
+  return json_string_size (str);
+}
+
+char *
+n2a_encode (json_t *jdata, size_t size)
+{
+  char *buffer = xmalloc (size + 1);
+  struct n2a_output out = { buffer, buffer + size, 0 };
+
+  if (g_options.encoding == N2A_MSG_MSGPACK)
+    n2a_msgpack_write (buffer, jdata);
+  else
+    json_dump_callback (jdata, copy_bytes, &out, 0);
+
+  buffer[size] = '\0';
+  return buffer;
+}
+
+char *
+n2a_dumps (json_t *jdata, size_t *size)
+{
+  *size = n2a_encoded_size (jdata);
+  return n2a_encode (jdata, *size);
+}
+
+char *
+n2a_encode_members (json_t *jdata, size_t *len)
+{
+  size_t size = n2a_encoded_size (jdata);
+  char *buffer = n2a_encode (jdata, size);
+
+  /* drop '{' and '}', or the map header */
+  if (g_options.encoding == N2A_MSG_MSGPACK)
+    {
+      size_t head = n2a_msgpack_map_size (json_object_size (jdata));
+      *len = size - head;
+      memmove (buffer, buffer + head, *len);
+    }
+  else
+    {
+      *len = size - 2;
+      memmove (buffer, buffer + 1, *len);
+    }
+  buffer[*len] = '\0';
+  return buffer;
+}
+
+size_t
+n2a_event_size (const struct n2a_object *o, json_t *jdata)
+{
+  size_t size = n2a_encoded_size (jdata);
+
+  if (g_options.encoding == N2A_MSG_MSGPACK)
+    return size + o->prefix_len
+      + n2a_msgpack_map_size (o->count + json_object_size (jdata))
+      - n2a_msgpack_map_size (json_object_size (jdata));
+
+  /* '{' prefix ', ' then jdata without its own '{' */
+  return size + o->prefix_len + 2;
+}
+
+/* what removing the member 'key' of 'jdata' takes off the event */
+static size_t
+member_size (const struct n2a_object *o, json_t *jdata, const char *key)
+{
+  json_t *value = json_object_get (jdata, key);
+  size_t n = json_object_size (jdata);
+
+  if (value == NULL)
+    return 0;
+
+  if (g_options.encoding == N2A_MSG_MSGPACK)
+    return n2a_msgpack_str_size (strlen (key)) + n2a_msgpack_size (value)
+      + n2a_msgpack_map_size (o->count + n) - n2a_msgpack_map_size (o->count + n - 1);
+
+  /* '"key": value' and its ', ' (the prefix is always in front of it) */
+  return json_string_size (key) + 2 + json_size (value) + 2;
+}
+
+/* encoded cost of the string member 'key' over an empty one, escaping
+ * included (0 when 'delta' left it out) */
+static size_t
+blank_cost (json_t *jdata, const char *key)
+{
+  json_t *value = json_object_get (jdata, key);
+
+  if (value == NULL || !json_is_string (value))
+    return 0;
+  return n2a_string_size (json_string_value (value)) - n2a_string_size ("");
+}
+
+char *
+n2a_event_encode (const struct n2a_object *o, json_t *jdata, size_t size)
+{
+  char *buffer = xmalloc (size + 1);
+  size_t n = json_object_size (jdata);
+
+  if (g_options.encoding == N2A_MSG_MSGPACK)
+    {
+      /* jdata goes right at the end so that its own map header is
+       * overwritten by the tail of the prefix */
+      size_t head = n2a_msgpack_map_size (o->count + n);
+      n2a_msgpack_write (buffer + head + o->prefix_len
+                         - n2a_msgpack_map_size (n), jdata);
+      memcpy (n2a_msgpack_write_map (buffer, o->count + n),
+              o->prefix, o->prefix_len);
+    }
+  else
+    {
+      struct n2a_output out = { buffer + o->prefix_len + 3, buffer + size, 1 };
+      buffer[0] = '{';
+      memcpy (buffer + 1, o->prefix, o->prefix_len);
+      memcpy (buffer + 1 + o->prefix_len, ", ", 2);
+      json_dump_callback (jdata, copy_bytes, &out, 0);
+    }
+
+  buffer[size] = '\0';
+  return buffer;
+}
+
+static json_int_t
+usec (const struct timeval *tv)
+{
+  return (json_int_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* 'timestamps': when nagios handed the check over (the module gets it
+ * right then), when the check ended and now, as the event is encoded */
+static void
+set_timestamps (json_t *jdata, const struct timeval *timestamp,
+                const struct timeval *end_time)
+{
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+  json_object_set_new (jdata, "timestamp_us", json_integer (usec (timestamp)));
+  if (end_time->tv_sec > 0)
+    json_object_set_new (jdata, "end_time_us", json_integer (usec (end_time)));
+  json_object_set_new (jdata, "published_us", json_integer (usec (&now)));
 }
 
 int
 nebstruct_service_check_data_to_json (nebstruct_service_check_data * c,
+                                      struct n2a_object *o,
                                       json_t **pdata,
                                       size_t *message_size)
 {
   int nbmsg = 1;
 
-  //service *service_object = c->object_ptr;
-  //host *host_object = service_object->host_ptr;
-
   json_t* item;
   
   *pdata = json_object();
   json_t* jdata = *pdata;
  
-  item = json_string(g_options.connector);
-  json_object_set(jdata, "connector", item);
-  json_decref(item);
-  
-  item = json_string(g_options.eventsource_name);
-  json_object_set(jdata, "connector_name", item);
-  json_decref(item);
-  
-  item = json_string("check");
-  json_object_set(jdata, "event_type", item);
-  json_decref(item);
-  
-  item = json_string("resource"); 
-  json_object_set(jdata, "source_type",	item);
-  json_decref(item);
-  
-  item = json_string(c->host_name);
-  json_object_set(jdata, "component", item);
-  json_decref(item);
-  
-  //item = json_string(host_object->address);
-  //json_object_set(jdata, "address",	item);
-  //json_decref(item);
-  
-  item = json_string(c->service_description);
-  json_object_set(jdata, "resource", item);
-  json_decref(item);
-  
+  /* address, groups and custom variables are in the object cache */
   item = json_integer((int) c->timestamp.tv_sec);
   json_object_set(jdata, "timestamp", item);
   json_decref(item);
@@ -117,18 +346,21 @@ nebstruct_service_check_data_to_json (nebstruct_service_check_data * c,
   json_object_set(jdata, "state_type", item);
   json_decref(item);
 
-  item = json_string("");
+  item = json_string(charnull(c->output));
   json_object_set(jdata, "output",	item);
   json_decref(item);
   
-  item = json_string(""); 
+  item = json_string(charnull(c->long_output)); 
   json_object_set(jdata, "long_output", item);
   json_decref(item);
   
-  item = json_string("");
+  item = json_string(charnull(c->perf_data));
   json_object_set(jdata, "perf_data", item);
   json_decref(item);
 
+  if (g_options.perfdata_array && c->perf_data && *c->perf_data)
+    json_object_set_new(jdata, "perf_data_array", n2a_perfdata_parse(c->perf_data));
+
   item = json_integer(c->check_type);
   json_object_set(jdata, "check_type", item);
   json_decref(item);
@@ -149,37 +381,26 @@ nebstruct_service_check_data_to_json (nebstruct_service_check_data * c,
   json_object_set(jdata, "latency", item);
   json_decref(item);
   
-  item = json_string(c->command_name);
-  json_object_set(jdata, "command_name", item);
-  json_decref(item);
-  
-  char *json = json_dumps(jdata, 0);
-  *message_size = xstrlen(json);
-  xfree (json);
-
-  int left = g_options.max_size - (int)*message_size;
-
-  size_t rest = xstrlen(c->long_output) + xstrlen(c->output) + xstrlen(c->perf_data);
-  if ((int)rest > left) {
-      /* we work with int so we add 1 to the division */
-      nbmsg = ((int)rest / left) + 1;
-  } else {
-      item = json_string(c->long_output);
-      json_object_set(jdata, "long_output", item);
+  if (n2a_limit_enabled ()) {
+      item = json_integer(o->suppressed);
+      json_object_set(jdata, "suppressed", item);
       json_decref(item);
+  }
 
-      item = json_string(c->output);
-      json_object_set(jdata, "output", item);
-      json_decref(item);
+  if (g_options.timestamps)
+    set_timestamps(jdata, &c->timestamp, &c->end_time);
 
-      item = json_string(c->perf_data);
-      json_object_set(jdata, "perf_data", item);
-      json_decref(item);
+  if (g_options.delta > 0)
+    n2a_object_delta(o, jdata);
 
-      json = json_dumps(jdata, 0);
-      *message_size = xstrlen(json);
-      xfree (json);
-  }
+  /* only the dynamic fields are here, the constant ones come already
+   * encoded from the object cache. exact encoded size, nothing is
+   * serialized until the caller knows whether the event fits in one
+   * message */
+  *message_size = n2a_event_size(o, jdata);
+
+  if ((int)*message_size > g_options.max_size)
+      nbmsg = (int)((*message_size + g_options.max_size - 1) / g_options.max_size);
 
   // Do not free the struct here since we work with a pointer
   // we will free it outside this function
@@ -190,11 +411,11 @@ nebstruct_service_check_data_to_json (nebstruct_service_check_data * c,
 
 int
 nebstruct_host_check_data_to_json (char **buffer,
+				   size_t *size,
+				   int *format,
+				   struct n2a_object *o,
 				   nebstruct_host_check_data * c)
 {
-
-  host *host_object = c->object_ptr;
-
   int nbmsg;
   int cstate = c->state;
   // Set to Critical
@@ -207,30 +428,7 @@ nebstruct_host_check_data_to_json (char **buffer,
   
   jdata = json_object();
  
-  item = json_string(g_options.connector);
-  json_object_set(jdata, "connector", item);
-  json_decref(item );
-  
-  item = json_string(g_options.eventsource_name);
-  json_object_set(jdata, "connector_name", item);
-  json_decref(item);
-  
-  item = json_string("check");
-  json_object_set(jdata, "event_type", item);
-  json_decref(item);
-  
-  item = json_string("component"); 
-  json_object_set(jdata, "source_type",	item);
-  json_decref(item);
-  
-  item = json_string(c->host_name);
-  json_object_set(jdata, "component", item);
-  json_decref(item);
-  
-  //item = json_string(host_object->address);
-  //json_object_set(jdata, "address",	item);
-  //json_decref(item);
-  
+  /* address, groups and custom variables are in the object cache */
   item = json_integer((int) c->timestamp.tv_sec);
   json_object_set(jdata, "timestamp", item);
   json_decref(item);
@@ -254,6 +452,9 @@ nebstruct_host_check_data_to_json (char **buffer,
   item = json_string(c->perf_data);
   json_object_set(jdata, "perf_data", item);
   json_decref(item);
+
+  if (g_options.perfdata_array && c->perf_data && *c->perf_data)
+    json_object_set_new(jdata, "perf_data_array", n2a_perfdata_parse(c->perf_data));
   
   item = json_integer(c->check_type);
   json_object_set(jdata, "check_type", item);
@@ -275,44 +476,212 @@ nebstruct_host_check_data_to_json (char **buffer,
   json_object_set(jdata, "latency", item);
   json_decref(item);
   
-  item = json_string(c->command_name);
-  json_object_set(jdata, "command_name", item);
-  json_decref(item);  
+  if (n2a_limit_enabled ()) {
+      item = json_integer(o->suppressed);
+      json_object_set(jdata, "suppressed", item);
+      json_decref(item);
+  }
 
-  char *json = json_dumps(jdata, 0);
-  size_t ref = xstrlen(json);
+  if (g_options.timestamps)
+    set_timestamps(jdata, &c->timestamp, &c->end_time);
+
+  if (g_options.delta > 0)
+    n2a_object_delta(o, jdata);
+
+  /* the constant fields come already encoded from the object cache */
+  size_t ref = n2a_event_size(o, jdata);
+
+  *format = g_options.encoding;
+
+  if ((int)ref > g_options.max_size && n2a_compress_wanted(ref)) {
+      /* compressed, the whole event may still fit in one message; this is
+       * the only case where the event has to be encoded before the
+       * decision is made */
+      size_t zlen = 0;
+      char *body = n2a_event_encode(o, jdata, ref);
+      char *zipped = n2a_compress(body, ref, &zlen);
+      xfree(body);
+      if (zipped != NULL && (int)zlen <= g_options.max_size) {
+          json_decref(jdata);
+          *buffer = zipped;
+          *size = zlen;
+          *format |= N2A_MSG_GZIP;
+          return nbmsg;
+      }
+      xfree(zipped);
+  }
 
   if ((int)ref > g_options.max_size) {
+      /* the size is adjusted by what the emptied field saves, the event
+       * is not sized again */
       size_t save = ref - g_options.max_size;
-      if (save <= xstrlen(c->long_output)) {
+      size_t cost;
+      if (save <= (cost = blank_cost(jdata, "long_output"))) {
           item = json_string("");
           json_object_set(jdata, "long_output", item);
           json_decref(item);
           n2a_logger(LG_INFO, "long_output is too long! (host: %s)", c->host_name);
-      } else if (save <= xstrlen(c->output)) {
+      } else if (save <= (cost = blank_cost(jdata, "output"))) {
           item = json_string("");
           json_object_set(jdata, "output", item);
           json_decref(item);
           n2a_logger(LG_INFO, "output is too long! (host: %s)", c->host_name);
-      } else if (save <= xstrlen(c->perf_data)) {
+      } else if (save <= (cost = blank_cost(jdata, "perf_data")
+                          + member_size(o, jdata, "perf_data_array"))) {
+          /* perf_data_array goes with it */
           item = json_string("");
           json_object_set(jdata, "perf_data", item);
           json_decref(item);
+          json_object_del(jdata, "perf_data_array");
           n2a_logger(LG_INFO, "perfdata is too long! (host: %s)", c->host_name);
+      } else {
+          cost = 0;
       }
-
-      xfree(json);
-      json = json_dumps(jdata, 0);
+      ref -= cost;
   }
 
-  ref = xstrlen(json);
-  *buffer = xmalloc(ref + 1);
-
-  snprintf(*buffer, ref + 1, "%s", json);
-
-  xfree(json);
+  *buffer = n2a_event_encode(o, jdata, ref);
+  *size = ref;
 
   json_decref(jdata);
  
   return nbmsg;
 }
+
+static void
+set_string (json_t *jdata, const char *field, const char *value)
+{
+  json_t *item = json_string(charnull((char *) value));
+  json_object_set(jdata, field, item);
+  json_decref(item);
+}
+
+static void
+set_integer (json_t *jdata, const char *field, json_int_t value)
+{
+  json_t *item = json_integer(value);
+  json_object_set(jdata, field, item);
+  json_decref(item);
+}
+
+/**
+ * fields and routing key shared by the events other than checks, built
+ * like the ones of the object cache. the key is allocated, the caller
+ * frees it.
+ */
+static json_t *
+event_identity (const char *event_type, const char *host_name,
+                const char *service_description, const struct timeval *timestamp,
+                char **key)
+{
+  json_t *jdata = json_object();
+  size_t l;
+
+  set_string(jdata, "connector", g_options.connector);
+  set_string(jdata, "connector_name", g_options.eventsource_name);
+  set_string(jdata, "event_type", event_type);
+  set_string(jdata, "source_type", service_description ? "resource" : "component");
+  set_string(jdata, "component", host_name);
+  if (service_description)
+      set_string(jdata, "resource", service_description);
+  set_integer(jdata, "timestamp", (int) timestamp->tv_sec);
+
+  // ".." + ".resource.." + \0
+  l = xstrlen(g_options.connector) + xstrlen(g_options.eventsource_name)
+      + xstrlen(event_type) + xstrlen(host_name) + xstrlen(service_description) + 16;
+  *key = xmalloc(l);
+  if (service_description)
+      snprintf(*key, l, "%s.%s.%s.resource.%s.%s", g_options.connector,
+               g_options.eventsource_name, event_type, charnull((char *) host_name),
+               service_description);
+  else
+      snprintf(*key, l, "%s.%s.%s.component.%s", g_options.connector,
+               g_options.eventsource_name, event_type, charnull((char *) host_name));
+  return jdata;
+}
+
+json_t *
+nebstruct_acknowledgement_data_to_json (nebstruct_acknowledgement_data *c, char **key)
+{
+  json_t *jdata = event_identity("ack", c->host_name, c->service_description,
+                                 &c->timestamp, key);
+
+  set_integer(jdata, "state", c->state);
+  set_string(jdata, "author", c->author_name);
+  set_string(jdata, "output", c->comment_data);
+  set_integer(jdata, "sticky", c->is_sticky);
+  set_integer(jdata, "persistent_comment", c->persistent_comment);
+  set_integer(jdata, "notify_contacts", c->notify_contacts);
+  return jdata;
+}
+
+json_t *
+nebstruct_downtime_data_to_json (nebstruct_downtime_data *c, char **key)
+{
+  json_t *jdata = event_identity("downtime", c->host_name, c->service_description,
+                                 &c->timestamp, key);
+  const char *action = "add";
+
+  if (c->type == NEBTYPE_DOWNTIME_DELETE)
+      action = "delete";
+  else if (c->type == NEBTYPE_DOWNTIME_START)
+      action = "start";
+  else if (c->type == NEBTYPE_DOWNTIME_STOP)
+      action = "stop";
+
+  set_string(jdata, "action", action);
+  set_string(jdata, "author", c->author_name);
+  set_string(jdata, "output", c->comment_data);
+  set_integer(jdata, "downtime_id", c->downtime_id);
+  set_integer(jdata, "entry_time", c->entry_time);
+  set_integer(jdata, "start", c->start_time);
+  set_integer(jdata, "end", c->end_time);
+  set_integer(jdata, "duration", c->duration);
+  set_integer(jdata, "fixed", c->fixed);
+  set_integer(jdata, "triggered_by", c->triggered_by);
+  return jdata;
+}
+
+json_t *
+nebstruct_comment_data_to_json (nebstruct_comment_data *c, char **key)
+{
+  json_t *jdata = event_identity("comment", c->host_name, c->service_description,
+                                 &c->timestamp, key);
+
+  set_string(jdata, "action", c->type == NEBTYPE_COMMENT_DELETE ? "delete" : "add");
+  set_string(jdata, "author", c->author_name);
+  set_string(jdata, "output", c->comment_data);
+  set_integer(jdata, "comment_id", c->comment_id);
+  set_integer(jdata, "entry_type", c->entry_type);
+  set_integer(jdata, "entry_time", c->entry_time);
+  set_integer(jdata, "persistent", c->persistent);
+  set_integer(jdata, "source", c->source);
+  set_integer(jdata, "expires", c->expires);
+  set_integer(jdata, "expire_time", c->expire_time);
+  return jdata;
+}
+
+json_t *
+nebstruct_program_status_data_to_json (nebstruct_program_status_data *c, char **key)
+{
+  /* the nagios instance is the component */
+  json_t *jdata = event_identity("program_status", g_options.eventsource_name, NULL,
+                                 &c->timestamp, key);
+
+  set_integer(jdata, "state", 0);
+  set_integer(jdata, "program_start", c->program_start);
+  set_integer(jdata, "pid", c->pid);
+  set_integer(jdata, "daemon_mode", c->daemon_mode);
+  set_integer(jdata, "last_command_check", c->last_command_check);
+  set_integer(jdata, "notifications_enabled", c->notifications_enabled);
+  set_integer(jdata, "active_service_checks_enabled", c->active_service_checks_enabled);
+  set_integer(jdata, "passive_service_checks_enabled", c->passive_service_checks_enabled);
+  set_integer(jdata, "active_host_checks_enabled", c->active_host_checks_enabled);
+  set_integer(jdata, "passive_host_checks_enabled", c->passive_host_checks_enabled);
+  set_integer(jdata, "event_handlers_enabled", c->event_handlers_enabled);
+  set_integer(jdata, "flap_detection_enabled", c->flap_detection_enabled);
+  set_integer(jdata, "process_performance_data", c->process_performance_data);
+  set_integer(jdata, "obsess_over_hosts", c->obsess_over_hosts);
+  set_integer(jdata, "obsess_over_services", c->obsess_over_services);
+  return jdata;
+}
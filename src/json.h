@@ -21,15 +21,33 @@
 #define json_h
 
 #include "jansson.h"
+#include "objcache.h"
 
-void nebstruct_service_check_data_update_json(json_t **pdata, const char *message, const char *field, int size, int cpt);
+char *charnull(char *data);
 
-int nebstruct_service_check_data_to_json(nebstruct_service_check_data *c, json_t **pdata, size_t *message_size);
-int nebstruct_host_check_data_to_json(char ** buffer, nebstruct_host_check_data *c);
 
-//void nebstruct_program_status_data_to_json(char * buffer, nebstruct_program_status_data *c);
-//void nebstruct_acknowledgement_data_to_json(char * buffer, nebstruct_acknowledgement_data *c);
-//void nebstruct_downtime_data_to_json(char * buffer, nebstruct_downtime_data *c);
-//void nebstruct_comment_data_to_json(char * buffer, nebstruct_comment_data *c);
+/* exact size of an event once encoded with the configured 'encoding' */
+size_t n2a_encoded_size(json_t *jdata);
+/* encoded size of a string value alone, quotes and escaping included */
+size_t n2a_string_size(const char *str);
+/* encode an event whose size is already known (NUL terminated) */
+char *n2a_encode(json_t *jdata, size_t size);
+/* encode an event with the configured 'encoding' (json or msgpack) */
+char *n2a_dumps(json_t *jdata, size_t *size);
+/* encode the members of an object without the object/map header itself */
+char *n2a_encode_members(json_t *jdata, size_t *len);
+/* size and encoding of an event made of the cached constant fields of 'o'
+ * followed by the members of 'jdata' */
+size_t n2a_event_size(const struct n2a_object *o, json_t *jdata);
+char *n2a_event_encode(const struct n2a_object *o, json_t *jdata, size_t size);
+
+int nebstruct_service_check_data_to_json(nebstruct_service_check_data *c, struct n2a_object *o, json_t **pdata, size_t *message_size);
+int nebstruct_host_check_data_to_json(char ** buffer, size_t *size, int *format, struct n2a_object *o, nebstruct_host_check_data *c);
+
+/* the other events, built whole; '*key' gets their routing key (to free) */
+json_t *nebstruct_program_status_data_to_json(nebstruct_program_status_data *c, char **key);
+json_t *nebstruct_acknowledgement_data_to_json(nebstruct_acknowledgement_data *c, char **key);
+json_t *nebstruct_downtime_data_to_json(nebstruct_downtime_data *c, char **key);
+json_t *nebstruct_comment_data_to_json(nebstruct_comment_data *c, char **key);
 
 #endif
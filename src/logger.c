@@ -25,12 +25,89 @@
 #include "module.h"
 #include "logger.h"
 #include "nagios.h"
+#include "xutils.h"
+#include "worker.h"
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
 extern struct options g_options;
 
+/* at most that many lines of the worker thread wait for the nagios one */
+#define N2A_LOG_QUEUE_MAX 1000
+
+struct n2a_log_line
+{
+  struct n2a_log_line *next;
+  int priority;
+  char text[1];
+};
+
+static struct n2a_log_line *queue_head = NULL;
+static struct n2a_log_line *queue_tail = NULL;
+static int queued = 0;
+static int dropped = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* write_to_all_logs is not thread safe: the worker only queues its lines */
+static void
+queue_line (int priority, const char *text)
+{
+  size_t len = strlen (text);
+  struct n2a_log_line *l;
+
+  pthread_mutex_lock (&queue_lock);
+  if (queued >= N2A_LOG_QUEUE_MAX)
+    {
+      dropped++;
+      pthread_mutex_unlock (&queue_lock);
+      return;
+    }
+  l = xmalloc (sizeof (*l) + len);
+  l->next = NULL;
+  l->priority = priority;
+  memcpy (l->text, text, len + 1);
+  if (queue_tail != NULL)
+    queue_tail->next = l;
+  else
+    queue_head = l;
+  queue_tail = l;
+  queued++;
+  pthread_mutex_unlock (&queue_lock);
+}
+
+void
+n2a_flush_log (void)
+{
+  struct n2a_log_line *l, *next;
+  int lost;
+  char buffer[128];
+
+  if (n2a_in_worker ())
+    return;
+
+  pthread_mutex_lock (&queue_lock);
+  l = queue_head;
+  lost = dropped;
+  queue_head = queue_tail = NULL;
+  queued = dropped = 0;
+  pthread_mutex_unlock (&queue_lock);
+
+  for (; l != NULL; l = next)
+    {
+      next = l->next;
+      write_to_all_logs (l->text, l->priority);
+      xfree (l);
+    }
+  if (lost > 0)
+    {
+      snprintf (buffer, sizeof (buffer),
+                "neb2amqp: %d log lines of the worker thread were dropped", lost);
+      write_to_all_logs (buffer, LG_INFO);
+    }
+}
+
 void
 n2a_logger (int priority, const char *loginfo, ...)
 {
@@ -47,5 +124,12 @@ n2a_logger (int priority, const char *loginfo, ...)
   vsnprintf (buffer + strlen (buffer), sizeof (buffer) - strlen (buffer),
 	     loginfo, ap);
   va_end (ap);
+  if (n2a_in_worker ())
+    {
+      queue_line (priority, buffer);
+      return;
+    }
+  /* keep the lines of the worker in front of the newer ones */
+  n2a_flush_log ();
   write_to_all_logs (buffer, priority);
 }
@@ -41,6 +41,9 @@ extern "C" {
 
    void n2a_logger (int priority, const char *loginfo, ...);
 
+   /* write the lines logged by the worker thread (nagios thread only) */
+   void n2a_flush_log (void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,6 +24,12 @@
 #include "broker.h"
 #include "neb2amqp.h"
 #include "cache.h"
+#include "batch.h"
+#include "objcache.h"
+#include "intern.h"
+#include "worker.h"
+#include "filter.h"
+#include "snapshot.h"
 #include "module.h"
 
 NEB_API_VERSION (CURRENT_NEB_API_VERSION)
@@ -35,6 +41,7 @@ extern int event_broker_options;
 struct options g_options;
 
 static void n2a_parse_arguments (const char *args_orig);
+static int n2a_parse_bool (const char *value, int def);
 
 
 /* this function gets called when the module is loaded by the event broker */
@@ -46,15 +53,54 @@ nebmodule_init (int flags __attribute__ ((__unused__)), char *args, nebmodule *h
 
   // Init default options
   g_options.eventsource_name = "Central";
+  g_options.transport = N2A_TRANSPORT_AMQP;
+  g_options.relay_socket = "/usr/local/nagios/var/rw/canopsis.sock";
   g_options.hostname = "127.0.0.1";
   g_options.port = 5672;
+  g_options.nmirrors = 0;
+  g_options.frame_max = 0;
+  g_options.channel_max = 0;
+  g_options.timeout = 2000;
+  g_options.tcp_nodelay = TRUE;
+  g_options.tcp_cork = TRUE;
+  g_options.sndbuf = 0;
+  g_options.keepalive = 60;
   g_options.userid = "guest";
   g_options.password = "guest";
   g_options.virtual_host = "canopsis";
   g_options.exchange_name = "canopsis.events";
   g_options.log_level = 0;
   g_options.connector = "nagios";
-  g_options.max_size = 8192;
+  g_options.max_size = N2A_CACHE_MAX_SIZE;
+  g_options.encoding = N2A_MSG_JSON;
+  g_options.compress = 0;
+  g_options.batch_size = 0;
+  g_options.batch_delay = 100;
+  g_options.worker = FALSE;
+  g_options.changes_only = FALSE;
+  g_options.refresh = 300;
+  g_options.delta = 0;
+  g_options.worker_buffer = 1048576;
+  g_options.ninclude = 0;
+  g_options.nexclude = 0;
+  g_options.limit = 0;
+  g_options.burst = 5;
+  g_options.nlimit_rule = 0;
+  g_options.nperfdata_sample = 0;
+  g_options.perfdata_array = FALSE;
+  g_options.timestamps = FALSE;
+  g_options.shutdown_timeout = 3000;
+  g_options.acknowledgements = FALSE;
+  g_options.downtimes = FALSE;
+  g_options.comments = FALSE;
+  g_options.program_status = 0;
+  g_options.snapshot = 0;
+  g_options.snapshot_budget = 5;
+  g_options.address = FALSE;
+  g_options.groups = FALSE;
+  g_options.custom_vars = "";
+  g_options.shed_latency = 0;
+  g_options.shed_cost = 0;
   g_options.cache_size = 10000;
   g_options.autosync = 60;
   g_options.autoflush = 60;
@@ -77,10 +123,25 @@ nebmodule_init (int flags __attribute__ ((__unused__)), char *args, nebmodule *h
       return 1;
    }
  
+  int i;
+  n2a_add_broker (g_options.hostname, g_options.port);
+  /* the relay agent does its own fan-out */
+  for (i = 0; g_options.transport == N2A_TRANSPORT_AMQP && i < g_options.nmirrors; i++)
+    n2a_add_broker (g_options.mirror[i],
+                    g_options.mirror_port[i] ? g_options.mirror_port[i] : g_options.port);
+
+  n2a_init_filter ();
+
   n2a_init_cache ();
 
   amqp_connect ();
 
+  n2a_init_batch ();
+
+  n2a_start_worker ();
+
+  n2a_init_snapshot ();
+
   register_callbacks ();
 
   n2a_logger (LG_INFO, "successfully finished initialization");
@@ -95,7 +156,17 @@ nebmodule_deinit (int flags __attribute__ ((__unused__)), int reason
   n2a_logger (LG_INFO, "deinitializing");
   
   deregister_callbacks ();
+  n2a_deinit_snapshot ();
+  /* what is queued goes to the brokers until the deadline, to the cache
+   * after it */
+  n2a_drain_start (g_options.shutdown_timeout);
+  n2a_stop_worker ();
+  n2a_deinit_batch ();
+  n2a_drain_finish ();
   n2a_clear_cache ();
+  n2a_clear_objects ();
+  n2a_clear_intern ();
+  n2a_deinit_filter ();
   amqp_disconnect ();
  
   xfree (g_args);
@@ -196,9 +267,84 @@ n2a_parse_arguments (const char *args_orig)
       else if (strcmp(left, "max_size") == 0)
         {
           g_options.max_size = strtol(right, NULL, 10);
+          if (g_options.max_size > N2A_CACHE_MAX_SIZE)
+            {
+              n2a_logger (LG_ERR, "max_size %d does not fit in the cache, using %d",
+                g_options.max_size, N2A_CACHE_MAX_SIZE);
+              g_options.max_size = N2A_CACHE_MAX_SIZE;
+            }
           n2a_logger (LG_DEBUG, "Setting max_size buffer to %d bits",
               g_options.max_size);
         }
+      else if (strcmp(left, "encoding") == 0)
+        {
+          if (strcmp (right, "msgpack") == 0)
+              g_options.encoding = N2A_MSG_MSGPACK;
+          else if (strcmp (right, "json") == 0)
+              g_options.encoding = N2A_MSG_JSON;
+          else
+              n2a_logger (LG_ERR, "Unknown encoding '%s', leave it to %s", right,
+                g_options.encoding == N2A_MSG_MSGPACK ? "msgpack" : "json");
+          n2a_logger (LG_DEBUG, "Setting encoding to %s",
+              g_options.encoding == N2A_MSG_MSGPACK ? "msgpack" : "json");
+        }
+      else if (strcmp(left, "compress") == 0)
+        {
+          g_options.compress = xmax (0, strtol(right, NULL, 10));
+          n2a_logger (LG_DEBUG, "Setting compress to %d bytes",
+              g_options.compress);
+        }
+      else if (strcmp(left, "batch_size") == 0)
+        {
+          g_options.batch_size = xmax (0, strtol(right, NULL, 10));
+          n2a_logger (LG_DEBUG, "Setting batch_size to %d events",
+              g_options.batch_size);
+        }
+      else if (strcmp(left, "batch_delay") == 0)
+        {
+          int r = strtol (right, NULL, 10);
+          if (r > 0) {
+              g_options.batch_delay = r;
+              n2a_logger (LG_DEBUG, "Setting batch_delay to %dms", r);
+          } else {
+              n2a_logger (LG_DEBUG, "Wrong value for option 'batch_delay', leave it to %dms",
+                g_options.batch_delay);
+          }
+        }
+      else if (strcmp(left, "worker") == 0)
+        {
+          g_options.worker = n2a_parse_bool (right, g_options.worker);
+          n2a_logger (LG_DEBUG, "Setting worker to '%s'",
+              g_options.worker ? "true": "false");
+        }
+      else if (strcmp(left, "changes_only") == 0)
+        {
+          g_options.changes_only = n2a_parse_bool (right, g_options.changes_only);
+          n2a_logger (LG_DEBUG, "Setting changes_only to '%s'",
+              g_options.changes_only ? "true": "false");
+        }
+      else if (strcmp(left, "refresh") == 0)
+        {
+          g_options.refresh = strtol(right, NULL, 10);
+          n2a_logger (LG_DEBUG, "Setting refresh to %ds", g_options.refresh);
+        }
+      else if (strcmp(left, "delta") == 0)
+        {
+          g_options.delta = xmax (0, strtol(right, NULL, 10));
+          n2a_logger (LG_DEBUG, "Setting delta to a full event every %d events",
+              g_options.delta);
+        }
+      else if (strcmp(left, "worker_buffer") == 0)
+        {
+          int r = strtol (right, NULL, 10);
+          if (r >= 4096) {
+              g_options.worker_buffer = r;
+              n2a_logger (LG_DEBUG, "Setting worker_buffer to %d bytes", r);
+          } else {
+              n2a_logger (LG_DEBUG, "Wrong value for option 'worker_buffer', leave it to %d bytes",
+                g_options.worker_buffer);
+          }
+        }
       else if (strcmp (left, "autoflush") == 0)
         {
           g_options.autoflush = strtol (right, NULL, 10);
@@ -253,6 +399,72 @@ n2a_parse_arguments (const char *args_orig)
 	      g_options.connector = right;
 	      n2a_logger (LG_DEBUG, "Setting connector to %s", g_options.connector);
 	    }
+	  else if (strcmp (left, "transport") == 0)
+	    {
+	      if (strcmp (right, "unix") == 0)
+	          g_options.transport = N2A_TRANSPORT_UNIX;
+	      else if (strcmp (right, "amqp") == 0)
+	          g_options.transport = N2A_TRANSPORT_AMQP;
+	      else
+	          n2a_logger (LG_ERR, "Unknown transport '%s', leave it to %s", right,
+	            g_options.transport == N2A_TRANSPORT_UNIX ? "unix" : "amqp");
+	      n2a_logger (LG_DEBUG, "Setting transport to %s",
+	          g_options.transport == N2A_TRANSPORT_UNIX ? "unix" : "amqp");
+	    }
+	  else if (strcmp (left, "relay_socket") == 0)
+	    {
+	      g_options.relay_socket = right;
+	      n2a_logger (LG_DEBUG, "Setting relay_socket to '%s'", g_options.relay_socket);
+	    }
+	  else if (strcmp (left, "frame_max") == 0)
+	    {
+	      int r = strtol (right, NULL, 10);
+	      if (r == 0 || r >= 4096) {
+	          g_options.frame_max = r;
+	          n2a_logger (LG_DEBUG, "Setting frame_max to %d", g_options.frame_max);
+	      } else {
+	          n2a_logger (LG_DEBUG, "Wrong value for option 'frame_max' (min 4096), leave it to %d",
+	            g_options.frame_max);
+	      }
+	    }
+	  else if (strcmp (left, "channel_max") == 0)
+	    {
+	      g_options.channel_max = strtol (right, NULL, 10);
+	      n2a_logger (LG_DEBUG, "Setting channel_max to %d", g_options.channel_max);
+	    }
+	  else if (strcmp (left, "timeout") == 0)
+	    {
+	      int r = strtol (right, NULL, 10);
+	      if (r > 0) {
+	          g_options.timeout = r;
+	          n2a_logger (LG_DEBUG, "Setting timeout to %dms", g_options.timeout);
+	      } else {
+	          n2a_logger (LG_DEBUG, "Wrong value for option 'timeout', leave it to %dms",
+	            g_options.timeout);
+	      }
+	    }
+	  else if (strcmp (left, "tcp_nodelay") == 0)
+	    {
+	      g_options.tcp_nodelay = n2a_parse_bool (right, g_options.tcp_nodelay);
+	      n2a_logger (LG_DEBUG, "Setting tcp_nodelay to '%s'",
+	          g_options.tcp_nodelay ? "true" : "false");
+	    }
+	  else if (strcmp (left, "tcp_cork") == 0)
+	    {
+	      g_options.tcp_cork = n2a_parse_bool (right, g_options.tcp_cork);
+	      n2a_logger (LG_DEBUG, "Setting tcp_cork to '%s'",
+	          g_options.tcp_cork ? "true" : "false");
+	    }
+	  else if (strcmp (left, "sndbuf") == 0)
+	    {
+	      g_options.sndbuf = xmax (0, strtol (right, NULL, 10));
+	      n2a_logger (LG_DEBUG, "Setting sndbuf to %d bytes", g_options.sndbuf);
+	    }
+	  else if (strcmp (left, "keepalive") == 0)
+	    {
+	      g_options.keepalive = xmax (0, strtol (right, NULL, 10));
+	      n2a_logger (LG_DEBUG, "Setting keepalive to %ds", g_options.keepalive);
+	    }
 	  else if (strcmp (left, "port") == 0)
 	    {
 	      g_options.port = strtol (right, NULL, 10);
@@ -275,6 +487,148 @@ n2a_parse_arguments (const char *args_orig)
 		}
 	      n2a_logger (LG_DEBUG, "Setting hostname to %s", g_options.hostname);
 	    }
+	  else if (strcmp (left, "mirror") == 0)
+	    {
+	      if (g_options.nmirrors >= N2A_MAX_MIRRORS)
+	        {
+	          n2a_logger (LG_ERR, "Too many mirrors (max %d), ignoring '%s'",
+	            N2A_MAX_MIRRORS, right);
+	          continue;
+	        }
+	      char *subpart = right;
+	      char *subleft = n2a_next_token (&subpart, ':');
+	      char *subright = n2a_next_token (&subpart, 0);
+	      int m = g_options.nmirrors++;
+	      if (subright == NULL)
+		{
+		  g_options.mirror[m] = subleft;
+		  g_options.mirror_port[m] = 0;
+		}
+	      else
+		{
+		  g_options.mirror[m] = subright;
+		  g_options.mirror_port[m] = strtol (subleft, NULL, 10);
+		}
+	      n2a_logger (LG_DEBUG, "Adding mirror %s", g_options.mirror[m]);
+	    }
+	  else if (strcmp (left, "acknowledgements") == 0)
+	    {
+	      g_options.acknowledgements = n2a_parse_bool (right, g_options.acknowledgements);
+	      n2a_logger (LG_DEBUG, "Setting acknowledgements to %d", g_options.acknowledgements);
+	    }
+	  else if (strcmp (left, "downtimes") == 0)
+	    {
+	      g_options.downtimes = n2a_parse_bool (right, g_options.downtimes);
+	      n2a_logger (LG_DEBUG, "Setting downtimes to %d", g_options.downtimes);
+	    }
+	  else if (strcmp (left, "comments") == 0)
+	    {
+	      g_options.comments = n2a_parse_bool (right, g_options.comments);
+	      n2a_logger (LG_DEBUG, "Setting comments to %d", g_options.comments);
+	    }
+	  else if (strcmp (left, "program_status") == 0)
+	    {
+	      g_options.program_status = xmax (0, strtol (right, NULL, 10));
+	      n2a_logger (LG_DEBUG, "Setting program_status to %ds", g_options.program_status);
+	    }
+	  else if (strcmp (left, "address") == 0)
+	    {
+	      g_options.address = n2a_parse_bool (right, g_options.address);
+	      n2a_logger (LG_DEBUG, "Setting address to %d", g_options.address);
+	    }
+	  else if (strcmp (left, "groups") == 0)
+	    {
+	      g_options.groups = n2a_parse_bool (right, g_options.groups);
+	      n2a_logger (LG_DEBUG, "Setting groups to %d", g_options.groups);
+	    }
+	  else if (strcmp (left, "custom_vars") == 0)
+	    {
+	      g_options.custom_vars = right;
+	      n2a_logger (LG_DEBUG, "Setting custom_vars to %s", g_options.custom_vars);
+	    }
+	  else if (strcmp (left, "shed_latency") == 0)
+	    {
+	      g_options.shed_latency = strtod (right, NULL);
+	      n2a_logger (LG_DEBUG, "Setting shed_latency to %.2fs", g_options.shed_latency);
+	    }
+	  else if (strcmp (left, "shed_cost") == 0)
+	    {
+	      g_options.shed_cost = xmax (0, strtol (right, NULL, 10));
+	      n2a_logger (LG_DEBUG, "Setting shed_cost to %dus", g_options.shed_cost);
+	    }
+	  else if (strcmp (left, "snapshot") == 0)
+	    {
+	      g_options.snapshot = xmax (0, strtol (right, NULL, 10));
+	      n2a_logger (LG_DEBUG, "Setting snapshot to %ds", g_options.snapshot);
+	    }
+	  else if (strcmp (left, "snapshot_budget") == 0)
+	    {
+	      g_options.snapshot_budget = xmax (1, strtol (right, NULL, 10));
+	      n2a_logger (LG_DEBUG, "Setting snapshot_budget to %dms", g_options.snapshot_budget);
+	    }
+	  else if (strcmp (left, "limit") == 0)
+	    {
+	      g_options.limit = xmax (0, strtol (right, NULL, 10));
+	      n2a_logger (LG_DEBUG, "Setting limit to %d checks/min per object", g_options.limit);
+	    }
+	  else if (strcmp (left, "burst") == 0)
+	    {
+	      g_options.burst = xmax (1, strtol (right, NULL, 10));
+	      n2a_logger (LG_DEBUG, "Setting burst to %d", g_options.burst);
+	    }
+	  else if (strcmp (left, "limit_rule") == 0)
+	    {
+	      if (g_options.nlimit_rule >= N2A_MAX_RULES)
+	        {
+	          n2a_logger (LG_ERR, "Too many limit rules (max %d), ignoring '%s'",
+	            N2A_MAX_RULES, right);
+	          continue;
+	        }
+	      g_options.limit_rule[g_options.nlimit_rule++] = right;
+	      n2a_logger (LG_DEBUG, "Adding limit rule %s", right);
+	    }
+	  else if (strcmp (left, "shutdown_timeout") == 0)
+	    {
+	      g_options.shutdown_timeout = xmax (0, strtol (right, NULL, 10));
+	      n2a_logger (LG_DEBUG, "Setting shutdown_timeout to %dms", g_options.shutdown_timeout);
+	    }
+	  else if (strcmp (left, "timestamps") == 0)
+	    {
+	      g_options.timestamps = n2a_parse_bool (right, g_options.timestamps);
+	      n2a_logger (LG_DEBUG, "Setting timestamps to %d", g_options.timestamps);
+	    }
+	  else if (strcmp (left, "perfdata_array") == 0)
+	    {
+	      g_options.perfdata_array = n2a_parse_bool (right, g_options.perfdata_array);
+	      n2a_logger (LG_DEBUG, "Setting perfdata_array to %d", g_options.perfdata_array);
+	    }
+	  else if (strcmp (left, "perfdata_sample") == 0)
+	    {
+	      if (g_options.nperfdata_sample >= N2A_MAX_RULES)
+	        {
+	          n2a_logger (LG_ERR, "Too many perfdata samples (max %d), ignoring '%s'",
+	            N2A_MAX_RULES, right);
+	          continue;
+	        }
+	      g_options.perfdata_sample[g_options.nperfdata_sample++] = right;
+	      n2a_logger (LG_DEBUG, "Adding perfdata sample %s", right);
+	    }
+	  else if (strcmp (left, "include") == 0 || strcmp (left, "exclude") == 0)
+	    {
+	      int include = (left[0] == 'i');
+	      int *n = include ? &g_options.ninclude : &g_options.nexclude;
+	      if (*n >= N2A_MAX_RULES)
+	        {
+	          n2a_logger (LG_ERR, "Too many %s rules (max %d), ignoring '%s'",
+	            left, N2A_MAX_RULES, right);
+	          continue;
+	        }
+	      if (include)
+	        g_options.include[(*n)++] = right;
+	      else
+	        g_options.exclude[(*n)++] = right;
+	      n2a_logger (LG_DEBUG, "Adding %s rule %s", left, right);
+	    }
 	  else
 	    {
 	      n2a_logger (LG_ERR, "Ignoring invalid option %s=%s", left, right);
@@ -283,3 +637,15 @@ n2a_parse_arguments (const char *args_orig)
     }
     g_args = save;
 }
+
+static int
+n2a_parse_bool (const char *value, int def)
+{
+  if (strncasecmp (value, "y", 1) == 0 || strncasecmp (value, "t", 1) == 0
+      || strcmp (value, "1") == 0)
+    return TRUE;
+  if (strncasecmp (value, "n", 1) == 0 || strncasecmp (value, "f", 1) == 0
+      || strcmp (value, "0") == 0)
+    return FALSE;
+  return def;
+}
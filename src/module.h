@@ -25,13 +25,64 @@
 #define FALSE 0
 #define TRUE 1
 
+#define N2A_TRANSPORT_AMQP 0
+#define N2A_TRANSPORT_UNIX 1
+
+#define N2A_MAX_MIRRORS 3
+#define N2A_MAX_RULES 32
+
 int nebmodule_init(int flags __attribute__ ((__unused__)), char *args, nebmodule *handle);
 int nebmodule_deinit(int flags __attribute__ ((__unused__)), int reason __attribute__ ((__unused__)));
 
 struct options {
+	int transport;
+	char *relay_socket;
 	char *hostname;
 	int port;
+	char *mirror[N2A_MAX_MIRRORS];
+	int mirror_port[N2A_MAX_MIRRORS];
+	int nmirrors;
+	int frame_max;
+	int channel_max;
+	int timeout;
+	int tcp_nodelay;
+	int tcp_cork;
+	int sndbuf;
+	int keepalive;
     int max_size;
+    int encoding;
+    int compress;
+    int batch_size;
+    int batch_delay;
+    int worker;
+    int changes_only;
+    int refresh;
+    int delta;
+    int worker_buffer;
+    char *include[N2A_MAX_RULES];
+    int ninclude;
+    char *exclude[N2A_MAX_RULES];
+    int nexclude;
+    int limit;
+    int burst;
+    char *limit_rule[N2A_MAX_RULES];
+    int nlimit_rule;
+    char *perfdata_sample[N2A_MAX_RULES];
+    int nperfdata_sample;
+    int perfdata_array;
+    int timestamps;
+    int shutdown_timeout;
+    int acknowledgements;
+    int downtimes;
+    int comments;
+    int program_status;
+    int snapshot;
+    int snapshot_budget;
+    int address;
+    int groups;
+    char *custom_vars;
+    double shed_latency;
+    int shed_cost;
     int cache_size;
     int autosync;
     int autoflush;
@@ -0,0 +1,209 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "xutils.h"
+#include "msgpack.h"
+
+/* bytes needed by the header of a str/array/map of 'n' elements */
+static size_t
+header_size (size_t n, size_t fix, int is_str)
+{
+    if (n <= fix)
+        return 1;
+    if (is_str && n <= 0xff)
+        return 2;
+    if (n <= 0xffff)
+        return 3;
+    return 5;
+}
+
+size_t
+n2a_msgpack_str_size (size_t len)
+{
+    return header_size (len, 31, 1) + len;
+}
+
+static size_t
+integer_size (json_int_t i)
+{
+    if (i >= -32 && i <= 127)
+        return 1;
+    if (i >= INT8_MIN && i <= UINT8_MAX)
+        return 2;
+    if (i >= INT16_MIN && i <= UINT16_MAX)
+        return 3;
+    if (i >= INT32_MIN && i <= UINT32_MAX)
+        return 5;
+    return 9;
+}
+
+size_t
+n2a_msgpack_size (json_t *json)
+{
+    size_t size = 0, n;
+    void *iter;
+
+    switch (json_typeof (json)) {
+        case JSON_OBJECT:
+            size = header_size (json_object_size (json), 15, 0);
+            for (iter = json_object_iter (json); iter;
+                 iter = json_object_iter_next (json, iter)) {
+                n = strlen (json_object_iter_key (iter));
+                size += header_size (n, 31, 1) + n;
+                size += n2a_msgpack_size (json_object_iter_value (iter));
+            }
+            return size;
+        case JSON_ARRAY:
+            size = header_size (json_array_size (json), 15, 0);
+            for (n = 0; n < json_array_size (json); n++)
+                size += n2a_msgpack_size (json_array_get (json, n));
+            return size;
+        case JSON_STRING:
+            n = strlen (json_string_value (json));
+            return header_size (n, 31, 1) + n;
+        case JSON_INTEGER:
+            return integer_size (json_integer_value (json));
+        case JSON_REAL:
+            return 9;
+        default:
+            return 1;
+    }
+}
+
+static unsigned char *
+put_be (unsigned char *p, uint64_t v, int bytes)
+{
+    int i;
+    for (i = bytes - 1; i >= 0; i--)
+        *p++ = (v >> (8 * i)) & 0xff;
+    return p;
+}
+
+static unsigned char *
+put_header (unsigned char *p, size_t n, unsigned char fix, size_t fixmax,
+            unsigned char b8, unsigned char b16, unsigned char b32)
+{
+    if (n <= fixmax) {
+        *p++ = fix | n;
+        return p;
+    }
+    if (b8 && n <= 0xff) {
+        *p++ = b8;
+        return put_be (p, n, 1);
+    }
+    if (n <= 0xffff) {
+        *p++ = b16;
+        return put_be (p, n, 2);
+    }
+    *p++ = b32;
+    return put_be (p, n, 4);
+}
+
+static unsigned char *
+put_string (unsigned char *p, const char *s)
+{
+    size_t n = strlen (s);
+    p = put_header (p, n, 0xa0, 31, 0xd9, 0xda, 0xdb);
+    memcpy (p, s, n);
+    return p + n;
+}
+
+static unsigned char *
+put_integer (unsigned char *p, json_int_t i)
+{
+    if (i >= -32 && i <= 127) {
+        *p++ = (unsigned char) (i & 0xff);
+        return p;
+    }
+    if (i >= 0) {
+        if (i <= UINT8_MAX) { *p++ = 0xcc; return put_be (p, i, 1); }
+        if (i <= UINT16_MAX) { *p++ = 0xcd; return put_be (p, i, 2); }
+        if (i <= UINT32_MAX) { *p++ = 0xce; return put_be (p, i, 4); }
+        *p++ = 0xcf;
+        return put_be (p, i, 8);
+    }
+    if (i >= INT8_MIN) { *p++ = 0xd0; return put_be (p, (uint64_t) i, 1); }
+    if (i >= INT16_MIN) { *p++ = 0xd1; return put_be (p, (uint64_t) i, 2); }
+    if (i >= INT32_MIN) { *p++ = 0xd2; return put_be (p, (uint64_t) i, 4); }
+    *p++ = 0xd3;
+    return put_be (p, (uint64_t) i, 8);
+}
+
+static unsigned char *
+msgpack_write (unsigned char *p, json_t *json)
+{
+    size_t n;
+    void *iter;
+
+    switch (json_typeof (json)) {
+        case JSON_OBJECT:
+            p = put_header (p, json_object_size (json), 0x80, 15, 0, 0xde, 0xdf);
+            for (iter = json_object_iter (json); iter;
+                 iter = json_object_iter_next (json, iter)) {
+                p = put_string (p, json_object_iter_key (iter));
+                p = msgpack_write (p, json_object_iter_value (iter));
+            }
+            return p;
+        case JSON_ARRAY:
+            p = put_header (p, json_array_size (json), 0x90, 15, 0, 0xdc, 0xdd);
+            for (n = 0; n < json_array_size (json); n++)
+                p = msgpack_write (p, json_array_get (json, n));
+            return p;
+        case JSON_STRING:
+            return put_string (p, json_string_value (json));
+        case JSON_INTEGER:
+            return put_integer (p, json_integer_value (json));
+        case JSON_REAL: {
+            union { double d; uint64_t u; } v;
+            v.d = json_real_value (json);
+            *p++ = 0xcb;
+            return put_be (p, v.u, 8);
+        }
+        case JSON_TRUE:
+            *p++ = 0xc3;
+            return p;
+        case JSON_FALSE:
+            *p++ = 0xc2;
+            return p;
+        default:
+            *p++ = 0xc0;
+            return p;
+    }
+}
+
+size_t
+n2a_msgpack_map_size (size_t n)
+{
+    return header_size (n, 15, 0);
+}
+
+char *
+n2a_msgpack_write_map (char *buffer, size_t n)
+{
+    return (char *) put_header ((unsigned char *) buffer, n, 0x80, 15, 0, 0xde, 0xdf);
+}
+
+void
+n2a_msgpack_write (char *buffer, json_t *json)
+{
+    msgpack_write ((unsigned char *) buffer, json);
+}
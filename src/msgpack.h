@@ -0,0 +1,49 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef msgpack_h
+#define msgpack_h
+
+#include "jansson.h"
+
+/**
+ * Exact size of the MessagePack encoding of a jansson value. the events
+ * keep the very same schema as their JSON version, only the encoding changes.
+ * @param json: value to size
+ * @return number of bytes n2a_msgpack_write() will produce
+ */
+size_t n2a_msgpack_size (json_t *json);
+
+/**
+ * MessagePack encoding of a jansson value.
+ * @param buffer: at least n2a_msgpack_size(json) bytes, not NUL terminated
+ * @param json: value to encode
+ */
+void n2a_msgpack_write (char *buffer, json_t *json);
+
+/* bytes taken by a MessagePack str of 'len' bytes, header included */
+size_t n2a_msgpack_str_size (size_t len);
+
+/* bytes taken by the header of a map of 'n' pairs */
+size_t n2a_msgpack_map_size (size_t n);
+
+/* write the header of a map of 'n' pairs, returns what follows it */
+char *n2a_msgpack_write_map (char *buffer, size_t n);
+
+#endif
@@ -20,11 +20,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 
 #include <stdint.h>
 #include <stdbool.h>
 
+#include <time.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <amqp.h>
 #include <amqp_framing.h>
@@ -32,21 +41,57 @@
 
 #include "neb2amqp.h"
 #include "cache.h"
+#include "batch.h"
+#include "compress.h"
 #include "module.h"
 #include "logger.h"
+#include "xutils.h"
 
 extern struct options g_options;
 
-static int sockfd;
+/**
+ * one entry per broker the events are published to. the first one is
+ * the 'host' option (or the local relay with transport=unix), the
+ * others come from 'mirror' and get a copy of every event.
+ */
+struct n2a_broker {
+  char *hostname;
+  int port;
+  int sockfd;
+  amqp_connection_state_t conn;
+  unsigned int connected;
+  int lastconnect;
+  bool first;
+  /* broker side flow control: the broker raised connection.blocked
+   * (memory or disk alarm) or sent channel.flow active=false */
+  bool blocked;
+  bool flow;
+};
+
+static struct n2a_broker brokers[N2A_MAX_BROKERS];
+static int nbrokers = 0;
+
+static const char *content_types[] = {
+  "application/json",                        /* N2A_MSG_JSON */
+  "application/vnd.canopsis.batch+json",     /* N2A_MSG_JSON | N2A_MSG_BATCH */
+  "application/x-msgpack",                   /* N2A_MSG_MSGPACK */
+  "application/vnd.canopsis.batch+msgpack",  /* N2A_MSG_MSGPACK | N2A_MSG_BATCH */
+};
 
 static bool amqp_errors = false;
-static bool first = true;
-static int amqp_lastconnect = 0;
 static int amqp_wait_time = 10;
 
-unsigned int amqp_connected = FALSE;
+/* local relay transport (transport=unix) */
+#define RELAY_PART 0x8000
+static int relay_type = SOCK_SEQPACKET;
+static char *relay_pending = NULL;
+static size_t relay_pending_len = 0;
+static size_t relay_pending_off = 0;
 
-static amqp_connection_state_t conn = NULL;
+/* shutdown drain: deadline (0 while running) and messages sent since */
+static struct timeval drain_start = { 0, 0 };
+static struct timeval drain_deadline = { 0, 0 };
+static int drained = 0;
 
 void
 on_error (int x, char const *context)
@@ -122,7 +167,330 @@ on_amqp_error (amqp_rpc_reply_t x, char const *context)
 
 
 void
-amqp_connect (void)
+n2a_add_broker (char *hostname, int port)
+{
+  if (nbrokers >= N2A_MAX_BROKERS)
+    {
+      n2a_logger (LG_ERR, "Too many brokers, ignoring '%s'", hostname);
+      return;
+    }
+
+  memset (&brokers[nbrokers], 0, sizeof (struct n2a_broker));
+  brokers[nbrokers].hostname = hostname;
+  brokers[nbrokers].port = port;
+  brokers[nbrokers].sockfd = -1;
+  brokers[nbrokers].first = true;
+  brokers[nbrokers].flow = true;
+  nbrokers++;
+}
+
+int
+n2a_broker_count (void)
+{
+  return nbrokers;
+}
+
+const char *
+n2a_broker_name (int broker)
+{
+  if (g_options.transport == N2A_TRANSPORT_UNIX)
+    return g_options.relay_socket;
+  return brokers[broker].hostname;
+}
+
+/**
+ * apply the socket related module options on a freshly opened socket.
+ * failures are logged but never fatal, the kernel defaults are fine.
+ */
+static void
+amqp_tune_socket (int fd)
+{
+  int one = 1, zero = 0;
+
+  if (!g_options.tcp_nodelay
+      && setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &zero, sizeof (zero)) < 0)
+    n2a_logger (LG_ERR, "AMQP: TCP_NODELAY: %s", strerror (errno));
+
+  /* setting SO_SNDBUF disables the kernel autotuning, only do it when
+   * asked to (WAN pollers with a large bandwidth-delay product) */
+  if (g_options.sndbuf > 0
+      && setsockopt (fd, SOL_SOCKET, SO_SNDBUF, &g_options.sndbuf,
+                     sizeof (g_options.sndbuf)) < 0)
+    n2a_logger (LG_ERR, "AMQP: SO_SNDBUF: %s", strerror (errno));
+
+  if (g_options.keepalive > 0)
+    {
+      if (setsockopt (fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof (one)) < 0)
+        n2a_logger (LG_ERR, "AMQP: SO_KEEPALIVE: %s", strerror (errno));
+#ifdef TCP_KEEPIDLE
+      int interval = xmax (1, g_options.keepalive / 3), count = 3;
+      if (setsockopt (fd, IPPROTO_TCP, TCP_KEEPIDLE, &g_options.keepalive,
+                      sizeof (g_options.keepalive)) < 0
+          || setsockopt (fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval,
+                         sizeof (interval)) < 0
+          || setsockopt (fd, IPPROTO_TCP, TCP_KEEPCNT, &count,
+                         sizeof (count)) < 0)
+        n2a_logger (LG_ERR, "AMQP: TCP keepalive: %s", strerror (errno));
+#endif
+    }
+}
+
+/**
+ * drain the frames the broker sent us without ever blocking, so we notice
+ * connection.blocked/unblocked and channel.flow before writing anything.
+ * returns FALSE if the broker closed the connection or the channel.
+ */
+static bool
+amqp_check_input (struct n2a_broker *b)
+{
+  amqp_frame_t frame;
+  int res;
+
+  while ((res = amqp_simple_poll_frame (b->conn, &frame)) > 0)
+    {
+      if (frame.frame_type != AMQP_FRAME_METHOD)
+        continue;
+
+      switch (frame.payload.method.id)
+        {
+        case AMQP_CONNECTION_BLOCKED_METHOD:
+          {
+            amqp_connection_blocked_t *m =
+              (amqp_connection_blocked_t *) frame.payload.method.decoded;
+            n2a_logger (LG_INFO, "AMQP: Broker %s blocked publishing: %.*s",
+                        b->hostname, (int) m->reason.len, (char *) m->reason.bytes);
+            b->blocked = true;
+            break;
+          }
+        case AMQP_CONNECTION_UNBLOCKED_METHOD:
+          n2a_logger (LG_INFO, "AMQP: Broker %s unblocked publishing", b->hostname);
+          b->blocked = false;
+          break;
+        case AMQP_CHANNEL_FLOW_METHOD:
+          {
+            amqp_channel_flow_t *m =
+              (amqp_channel_flow_t *) frame.payload.method.decoded;
+            amqp_channel_flow_ok_t ok;
+            b->flow = m->active;
+            ok.active = m->active;
+            n2a_logger (LG_INFO, "AMQP: Channel flow %s on %s",
+                        b->flow ? "resumed" : "paused", b->hostname);
+            on_error (amqp_send_method (b->conn, frame.channel,
+                                        AMQP_CHANNEL_FLOW_OK_METHOD, &ok),
+                      "Acknowledging channel flow");
+            break;
+          }
+        case AMQP_CONNECTION_CLOSE_METHOD:
+        case AMQP_CHANNEL_CLOSE_METHOD:
+          {
+            amqp_rpc_reply_t reply;
+            reply.reply_type = AMQP_RESPONSE_SERVER_EXCEPTION;
+            reply.reply = frame.payload.method;
+            on_amqp_error (reply, "Reading input");
+            break;
+          }
+        default:
+          break;
+        }
+    }
+
+  on_error (res, "Reading input");
+  amqp_maybe_release_buffers (b->conn);
+
+  return !amqp_errors;
+}
+
+/**
+ * the relay transport hands every message to a local agent over a UNIX
+ * domain socket. each record is:
+ *   uint32_t length   (network order, size of what follows)
+ *   uint16_t key_len  (network order, RELAY_PART set for a part)
+ *   char     key[key_len & ~RELAY_PART]
+ *   [uint16_t index, uint16_t count, uint8_t id_len, char id[id_len]]
+ *   char     body[...]
+ * the bracketed part header is only there when RELAY_PART is set, so
+ * events which fit in 'max_size' keep the plain framing.
+ * SOCK_SEQPACKET is tried first so a record is always one packet; agents
+ * listening on a SOCK_STREAM socket get the very same framing.
+ */
+static void
+relay_close (struct n2a_broker *b)
+{
+  if (b->sockfd >= 0)
+    close (b->sockfd);
+  b->sockfd = -1;
+  xfree (relay_pending);
+  relay_pending = NULL;
+  relay_pending_len = relay_pending_off = 0;
+  b->connected = FALSE;
+}
+
+static void
+relay_connect (struct n2a_broker *b)
+{
+  struct sockaddr_un addr;
+  int types[2] = { SOCK_SEQPACKET, SOCK_STREAM };
+  int i;
+
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  int now = tv.tv_sec;
+
+  if (b->connected || (b->lastconnect != 0 && (now - b->lastconnect) < amqp_wait_time))
+    return;
+  b->lastconnect = now;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strncpy (addr.sun_path, g_options.relay_socket, sizeof (addr.sun_path) - 1);
+
+  for (i = 0; i < 2; i++)
+    {
+      b->sockfd = socket (AF_UNIX, types[i], 0);
+      if (b->sockfd < 0)
+        continue;
+      if (connect (b->sockfd, (struct sockaddr *) &addr, sizeof (addr)) == 0)
+        break;
+      close (b->sockfd);
+      b->sockfd = -1;
+      /* a listener of the other type answers with EPROTOTYPE */
+      if (errno != EPROTOTYPE && errno != ESOCKTNOSUPPORT && errno != EPROTONOSUPPORT)
+        break;
+    }
+
+  if (b->sockfd < 0)
+    {
+      n2a_logger (LG_ERR, "RELAY: %s: %s", g_options.relay_socket, strerror (errno));
+      return;
+    }
+
+  relay_type = types[i];
+  n2a_logger (LG_INFO, "RELAY: Successfully connected to '%s' (%s)", g_options.relay_socket,
+              relay_type == SOCK_SEQPACKET ? "seqpacket" : "stream");
+  b->connected = TRUE;
+}
+
+/**
+ * finish writing a record a stream socket only partially accepted.
+ * returns TRUE once nothing is left pending.
+ */
+static bool
+relay_flush_pending (struct n2a_broker *b)
+{
+  while (relay_pending_off < relay_pending_len)
+    {
+      ssize_t r = send (b->sockfd, relay_pending + relay_pending_off,
+                        relay_pending_len - relay_pending_off, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (r < 0)
+        {
+          if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return false;
+          n2a_logger (LG_ERR, "RELAY: send: %s", strerror (errno));
+          relay_close (b);
+          return false;
+        }
+      relay_pending_off += r;
+    }
+  xfree (relay_pending);
+  relay_pending = NULL;
+  relay_pending_len = relay_pending_off = 0;
+  return true;
+}
+
+static int
+relay_publish (struct n2a_broker *b, const char *routingkey, const char *message, size_t mlen,
+               const struct n2a_part *part)
+{
+  /* a slow relay is backpressure, not an error: keep the socket and
+   * let the cache absorb the messages until it catches up */
+  if (!relay_flush_pending (b))
+    return -1;
+
+  size_t klen = xstrlen (routingkey);
+  uint16_t key_len = htons ((uint16_t) klen);
+  unsigned char header[5];
+  struct iovec iov[6];
+  struct msghdr msg;
+  size_t total = 0;
+  int i, niov = 0;
+
+  iov[niov].iov_base = NULL;
+  iov[niov++].iov_len = sizeof (uint32_t);
+  iov[niov].iov_base = &key_len;
+  iov[niov++].iov_len = sizeof (key_len);
+  iov[niov].iov_base = (void *) routingkey;
+  iov[niov++].iov_len = klen;
+  if (part != NULL)
+    {
+      size_t idlen = xmin (255, (int) xstrlen (part->id));
+      key_len = htons ((uint16_t) (klen | RELAY_PART));
+      header[0] = part->index >> 8;
+      header[1] = part->index;
+      header[2] = part->count >> 8;
+      header[3] = part->count;
+      header[4] = idlen;
+      iov[niov].iov_base = header;
+      iov[niov++].iov_len = sizeof (header);
+      iov[niov].iov_base = (void *) part->id;
+      iov[niov++].iov_len = idlen;
+    }
+  iov[niov].iov_base = (void *) message;
+  iov[niov++].iov_len = mlen;
+
+  for (i = 1; i < niov; i++)
+    total += iov[i].iov_len;
+  uint32_t length = htonl ((uint32_t) total);
+  iov[0].iov_base = &length;
+  total += sizeof (length);
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = niov;
+
+  ssize_t r = sendmsg (b->sockfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (r < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return -1;
+      if (errno == EMSGSIZE)
+        {
+          /* only with a 'max_size' above what the socket takes: retrying
+           * from the cache would fail the same way forever */
+          n2a_logger (LG_ERR, "RELAY: message too large for the relay socket, dropping '%s'",
+                      routingkey);
+          return 0;
+        }
+      n2a_logger (LG_ERR, "RELAY: send: %s", strerror (errno));
+      relay_close (b);
+      return -1;
+    }
+
+  if ((size_t) r < total)
+    {
+      /* stream socket took part of the record: the rest has to go out
+       * before anything else or the relay would lose the framing */
+      size_t skip = r, off = 0;
+      relay_pending_len = total - r;
+      relay_pending_off = 0;
+      relay_pending = xmalloc (relay_pending_len);
+      for (i = 0; i < niov; i++)
+        {
+          if (skip >= iov[i].iov_len)
+            {
+              skip -= iov[i].iov_len;
+              continue;
+            }
+          memcpy (relay_pending + off, (char *) iov[i].iov_base + skip, iov[i].iov_len - skip);
+          off += iov[i].iov_len - skip;
+          skip = 0;
+        }
+    }
+
+  return 0;
+}
+
+static void
+broker_connect (struct n2a_broker *b)
 {
   amqp_errors = false;
 
@@ -130,124 +498,382 @@ amqp_connect (void)
   gettimeofday (&tv, NULL);
   int now = tv.tv_sec;
 
-  if ((amqp_lastconnect == 0) || (!amqp_connected && (now - amqp_lastconnect) >= amqp_wait_time) )
+  if ((b->lastconnect == 0) || (!b->connected && (now - b->lastconnect) >= amqp_wait_time) )
   {
-    amqp_lastconnect = now;
-    amqp_connected = FALSE;
+    b->lastconnect = now;
+    b->connected = FALSE;
+    b->blocked = false;
+    b->flow = true;
 
-    if (conn)
+    if (b->conn)
   	{
-        amqp_destroy_connection(conn);
-        amqp_socket_close(sockfd);
+        amqp_destroy_connection(b->conn);
+        b->conn = NULL;
   	}
   	  
-    n2a_logger (LG_DEBUG, "AMQP: Opening socket");
-    on_error (sockfd = amqp_open_socket (g_options.hostname, g_options.port), "Opening socket");
+    struct timeval timeout;
+    timeout.tv_sec = g_options.timeout / 1000;
+    timeout.tv_usec = (g_options.timeout % 1000) * 1000;
+
+    n2a_logger (LG_DEBUG, "AMQP: Opening socket to %s:%d", b->hostname, b->port);
+    on_error (b->sockfd = amqp_open_socket_timeout (b->hostname, b->port, &timeout), "Opening socket");
 
     if (!amqp_errors)
   	{
+        amqp_tune_socket (b->sockfd);
         n2a_logger (LG_DEBUG, "AMQP: Init connection");
-        conn = amqp_new_connection ();
+        b->conn = amqp_new_connection ();
+        amqp_set_coalesce_frames (b->conn, g_options.tcp_cork);
   	}
   	
     if (!amqp_errors)
   	{
-  	  amqp_set_sockfd (conn, sockfd);
+  	  amqp_set_sockfd (b->conn, b->sockfd);
 
   	  n2a_logger (LG_DEBUG, "AMQP: Logging");
-  	  on_amqp_error (amqp_login(conn, g_options.virtual_host, 0, 131072, 0, AMQP_SASL_METHOD_PLAIN, g_options.userid, g_options.password), "Logging in");
+  	  on_amqp_error (amqp_login(b->conn, g_options.virtual_host, g_options.channel_max, g_options.frame_max, 0, AMQP_SASL_METHOD_PLAIN, g_options.userid, g_options.password), "Logging in");
   	}
 
+    if (!amqp_errors)
+      n2a_logger (LG_DEBUG, "AMQP: Tuned to frame_max=%d, channel_max=%d",
+                  amqp_get_frame_max (b->conn), amqp_get_channel_max (b->conn));
+
     if (!amqp_errors)
   	{
   	  n2a_logger (LG_DEBUG, "AMQP: Open channel");
-  	  amqp_channel_open (conn, 1);
-  	  on_amqp_error (amqp_get_rpc_reply (conn), "Opening channel");
+  	  amqp_channel_open (b->conn, 1);
+  	  on_amqp_error (amqp_get_rpc_reply (b->conn), "Opening channel");
   	}
 
     if (!amqp_errors){
-      n2a_logger (LG_INFO, "AMQP: Successfully connected");
-      amqp_connected = TRUE;
+      n2a_logger (LG_INFO, "AMQP: Successfully connected to %s", b->hostname);
+      b->connected = TRUE;
     }
-        
-    if (amqp_connected)
-  	{
-      if (!first || g_options.purge) {
-        unsigned int force = TRUE;
-        n2a_pop_all_cache ((void *)&force);
-      }
-      first = false;
-  	}
   }
 }
 
-void
-amqp_disconnect (void)
+static void
+broker_disconnect (struct n2a_broker *b)
 {
   amqp_errors = false;
   
-  if (amqp_connected)
+  if (b->connected)
     {
       n2a_logger (LG_DEBUG, "AMQP: Closing channel");
-      on_amqp_error (amqp_channel_close (conn, 1, AMQP_REPLY_SUCCESS),
+      on_amqp_error (amqp_channel_close (b->conn, 1, AMQP_REPLY_SUCCESS),
 		     "Closing channel");
 
       n2a_logger (LG_DEBUG, "AMQP: Closing connection");
-      on_amqp_error (amqp_connection_close (conn, AMQP_REPLY_SUCCESS),
+      on_amqp_error (amqp_connection_close (b->conn, AMQP_REPLY_SUCCESS),
 		     "Closing connection");
 
       n2a_logger (LG_DEBUG, "AMQP: Ending connection");
-      on_error (amqp_destroy_connection (conn), "Ending connection");
+      on_error (amqp_destroy_connection (b->conn), "Ending connection");
       
-      conn = NULL;
-      amqp_connected = FALSE;
+      b->conn = NULL;
+      b->sockfd = -1;
+      b->connected = FALSE;
 
-      amqp_socket_close(sockfd);
-      
-      n2a_logger (LG_INFO, "AMQP: Successfully disconnected");
+      n2a_logger (LG_INFO, "AMQP: Successfully disconnected from %s", b->hostname);
     }
   else
     {
-      n2a_logger (LG_INFO, "AMQP: Impossible to disconnect, not connected");
+      n2a_logger (LG_INFO, "AMQP: Impossible to disconnect from %s, not connected", b->hostname);
+    }
+}
+
+int
+n2a_broker_connect (int broker)
+{
+  struct n2a_broker *b = &brokers[broker];
+  unsigned int was = b->connected;
+
+  if (g_options.transport == N2A_TRANSPORT_UNIX)
+    relay_connect (b);
+  else if (!b->connected)
+    broker_connect (b);
+
+  /* the link is back: send what piled up in the cache meanwhile (on
+   * startup only if we were asked to purge the cache) */
+  if (b->connected && !was)
+    {
+      if (!b->first || g_options.purge)
+        n2a_depile_cache (broker);
+      b->first = false;
     }
+
+  return b->connected;
 }
 
 int
-amqp_publish (const char *routingkey, const char *message)
+n2a_broker_publish (int broker, const char *routingkey, const char *message, size_t len,
+                    int format, const struct n2a_part *part)
 {
-  if (! amqp_connected)
-    amqp_connect ();
+  struct n2a_broker *b = &brokers[broker];
+
+  if (!b->connected)
+    n2a_broker_connect (broker);
+
+  if (!b->connected)
+    return -1;
+
+  if (g_options.transport == N2A_TRANSPORT_UNIX)
+    {
+      int r = relay_publish (b, routingkey, message, len, part);
+      if (r == 0 && n2a_draining ())
+        drained++;
+      return r;
+    }
+
+  amqp_errors = false;
 
-  if (amqp_connected)
+  if (!amqp_check_input (b))
   {
-    amqp_basic_properties_t props;
-    props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG | AMQP_BASIC_CONTENT_ENCODING_FLAG;
-    props.content_type = amqp_cstring_bytes ("application/json");
-    props.content_encoding = amqp_cstring_bytes ("UTF-8");
-    props.delivery_mode = 2;	/* persistent delivery mode */
+    n2a_logger (LG_INFO, "AMQP: Connection closed by %s", b->hostname);
+    broker_disconnect (b);
+    return -1;
+  }
+
+  /* the broker stopped reading from us: do not write anything, it would
+   * only block until SO_SNDTIMEO and tear the connection down. keep the
+   * message in the cache until the broker lifts the alarm */
+  if (b->blocked || !b->flow)
+    return -1;
+
+  amqp_basic_properties_t props;
+  props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
+  props.content_type = amqp_cstring_bytes ((char *) content_types[format & (N2A_MSG_BATCH | N2A_MSG_MSGPACK)]);
+  if (format & N2A_MSG_GZIP)
+    {
+      props._flags |= AMQP_BASIC_CONTENT_ENCODING_FLAG;
+      props.content_encoding = amqp_cstring_bytes ("gzip");
+    }
+  /* a charset only makes sense for the text encodings */
+  else if (!(format & N2A_MSG_MSGPACK))
+    {
+      props._flags |= AMQP_BASIC_CONTENT_ENCODING_FLAG;
+      props.content_encoding = amqp_cstring_bytes ("UTF-8");
+    }
+  props.delivery_mode = 2;	/* persistent delivery mode */
     
-   int result = amqp_basic_publish (conn,
+  amqp_table_entry_t headers[3];
+  int nheaders = 0;
+  if (part != NULL)
+    {
+      props._flags |= AMQP_BASIC_MESSAGE_ID_FLAG;
+      props.message_id = amqp_cstring_bytes ((char *) part->id);
+      headers[nheaders].key = amqp_cstring_bytes ("x-canopsis-part");
+      headers[nheaders].value.kind = AMQP_FIELD_KIND_I32;
+      headers[nheaders++].value.value.i32 = part->index;
+      headers[nheaders].key = amqp_cstring_bytes ("x-canopsis-parts");
+      headers[nheaders].value.kind = AMQP_FIELD_KIND_I32;
+      headers[nheaders++].value.value.i32 = part->count;
+    }
+  if (g_options.timestamps)
+    {
+      /* the property only has seconds, the header the microseconds. a
+       * message coming out of the cache gets the time it really left */
+      struct timeval now;
+      gettimeofday (&now, NULL);
+      props._flags |= AMQP_BASIC_TIMESTAMP_FLAG;
+      props.timestamp = (uint64_t) now.tv_sec;
+      headers[nheaders].key = amqp_cstring_bytes ("x-canopsis-published-us");
+      headers[nheaders].value.kind = AMQP_FIELD_KIND_I64;
+      headers[nheaders++].value.value.i64 = (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+    }
+  if (nheaders > 0)
+    {
+      props._flags |= AMQP_BASIC_HEADERS_FLAG;
+      props.headers.num_entries = nheaders;
+      props.headers.entries = headers;
+    }
+
+  amqp_bytes_t body;
+  body.len = len;
+  body.bytes = (void *) message;
+
+  int result = amqp_basic_publish (b->conn,
 			    1,
 			    amqp_cstring_bytes (g_options.exchange_name),
 			    amqp_cstring_bytes (routingkey),
 			    0,
 			    0,
 			    &props,
-			    amqp_cstring_bytes (message));
+			    body);
 
-    on_error (result, "Publishing");
+  on_error (result, "Publishing");
 
-    if (amqp_errors)
+  if (amqp_errors)
+  {
+    n2a_logger (LG_INFO, "AMQP: Error on publish to %s", b->hostname);
+    broker_disconnect (b);
+    return -1;
+  }
+  if (n2a_draining ())
+    drained++;
+  return 0;
+}
+
+void
+n2a_drain_start (int timeout)
+{
+  gettimeofday (&drain_start, NULL);
+  drain_deadline.tv_sec = drain_start.tv_sec + timeout / 1000;
+  drain_deadline.tv_usec = drain_start.tv_usec + (timeout % 1000) * 1000;
+  if (drain_deadline.tv_usec >= 1000000)
     {
-      n2a_record_cache (routingkey, message);
-      n2a_logger (LG_INFO, "AMQP: Error on publish");
-      amqp_disconnect ();
-      return -1;
+      drain_deadline.tv_sec++;
+      drain_deadline.tv_usec -= 1000000;
     }
-    return 0;
+  drained = 0;
+}
 
-  }else{
-    n2a_record_cache (routingkey, message);
-    return -1;
-  }
+int
+n2a_draining (void)
+{
+  return drain_start.tv_sec != 0;
+}
+
+int
+n2a_past_deadline (void)
+{
+  struct timeval now;
+
+  if (!n2a_draining ())
+    return FALSE;
+  gettimeofday (&now, NULL);
+  return timercmp (&now, &drain_deadline, >=);
+}
+
+void
+n2a_drain_finish (void)
+{
+  struct timeval now;
+  int i;
+
+  for (i = 0; i < nbrokers; i++)
+    while (n2a_cache_pending (i) && !n2a_past_deadline ()
+           && n2a_broker_connect (i) && n2a_depile_cache (i) > 0)
+      ;
+
+  gettimeofday (&now, NULL);
+  n2a_logger (LG_INFO, "shutdown: %d messages sent in %ld ms%s, %d left in the cache",
+              drained, (long) ((now.tv_sec - drain_start.tv_sec) * 1000
+                               + (now.tv_usec - drain_start.tv_usec) / 1000),
+              n2a_past_deadline () ? " (deadline reached)" : "", n2a_cache_count ());
+}
+
+void
+amqp_connect (void)
+{
+  int i;
+  for (i = 0; i < nbrokers; i++)
+    n2a_broker_connect (i);
+}
+
+void
+amqp_disconnect (void)
+{
+  int i;
+  for (i = 0; i < nbrokers; i++)
+    {
+      struct n2a_broker *b = &brokers[i];
+      if (g_options.transport == N2A_TRANSPORT_UNIX)
+        {
+          if (b->connected)
+            {
+              relay_flush_pending (b);
+              relay_close (b);
+              n2a_logger (LG_INFO, "RELAY: Successfully disconnected");
+            }
+        }
+      else
+        broker_disconnect (b);
+    }
+}
+
+/**
+ * publish one event on every broker. the message is serialized once by
+ * the caller and the same buffer is handed to each connection; brokers
+ * which cannot take it right now (or still have older messages waiting
+ * in the cache) get it through a single shared cache entry.
+ */
+int
+amqp_publish (const char *routingkey, const char *message, size_t len)
+{
+  if (n2a_batch_enabled ())
+    return n2a_batch_add (routingkey, message, len);
+  return amqp_publish_format (routingkey, message, len, g_options.encoding);
+}
+
+static int
+publish_all (const char *routingkey, const char *message, size_t len, int format,
+             const struct n2a_part *part)
+{
+  unsigned int pending = 0;
+  int i, late = n2a_past_deadline ();
+
+  for (i = 0; i < nbrokers; i++)
+    {
+      if (late || n2a_cache_pending (i)
+          || n2a_broker_publish (i, routingkey, message, len, format, part) < 0)
+        pending |= 1 << i;
+    }
+
+  if (pending)
+    n2a_record_cache_pending (routingkey, message, len, format, part, pending);
+
+  return pending ? -1 : 0;
+}
+
+int
+amqp_publish_format (const char *routingkey, const char *message, size_t len, int format)
+{
+  char *zipped = NULL;
+  int r;
+
+  /* whatever does not go through the batch must not overtake the events
+   * already waiting in it */
+  if (!(format & N2A_MSG_BATCH))
+    n2a_batch_flush ();
+
+  if (!(format & N2A_MSG_GZIP) && n2a_compress_wanted (len))
+    {
+      size_t zlen;
+      if ((zipped = n2a_compress (message, len, &zlen)) != NULL)
+        {
+          message = zipped;
+          len = zlen;
+          format |= N2A_MSG_GZIP;
+        }
+    }
+
+  r = publish_all (routingkey, message, len, format, NULL);
+
+  xfree (zipped);
+  return r;
+}
+
+/**
+ * publish an encoded event bigger than 'max_size' as several parts. the
+ * parts point into 'message', nothing is copied nor encoded again.
+ */
+int
+amqp_publish_parts (const char *routingkey, const char *message, size_t len, int format)
+{
+  static unsigned int serial = 0;
+  struct n2a_part part;
+  char id[128];
+  size_t off, max = g_options.max_size;
+  int r = n2a_batch_flush ();
+
+  snprintf (id, sizeof (id), "%s.%lx.%x", g_options.eventsource_name,
+            (unsigned long) time (NULL), serial++);
+  part.id = id;
+  part.count = (len + max - 1) / max;
+
+  for (part.index = 0, off = 0; off < len; part.index++, off += max)
+    r |= publish_all (routingkey, message + off, xmin ((int) max, (int) (len - off)), format, &part);
+
+  return r;
 }
@@ -22,11 +22,54 @@
 
 #include <amqp.h>
 
+#include "module.h"
+
 #define AMQP_MSG_SIZE_MAX 8192
 
+/* body formats, cached along with each message */
+#define N2A_MSG_JSON    0x0
+#define N2A_MSG_BATCH   0x1
+#define N2A_MSG_MSGPACK 0x2
+#define N2A_MSG_GZIP    0x4
+
+/**
+ * an event bigger than 'max_size' is sliced into several messages sharing
+ * the same message_id, each one carrying its position in the
+ * x-canopsis-part / x-canopsis-parts headers. the consumer concatenates
+ * the bodies in order to get the encoded event back.
+ */
+struct n2a_part {
+  const char *id;
+  int index;
+  int count;
+};
+
+/* 'host' plus up to N2A_MAX_MIRRORS 'mirror' brokers */
+#define N2A_MAX_BROKERS (N2A_MAX_MIRRORS + 1)
+
 void amqp_connect (void);
 void amqp_disconnect (void);
-int amqp_publish (const char *routingkey, const char *message);
+int amqp_publish (const char *routingkey, const char *message, size_t len);
+int amqp_publish_format (const char *routingkey, const char *message, size_t len, int format);
+int amqp_publish_parts (const char *routingkey, const char *message, size_t len, int format);
+
+void n2a_add_broker (char *hostname, int port);
+int n2a_broker_count (void);
+const char *n2a_broker_name (int broker);
+int n2a_broker_connect (int broker);
+int n2a_broker_publish (int broker, const char *routingkey, const char *message, size_t len,
+                        int format, const struct n2a_part *part);
+
+/**
+ * bounded shutdown: the brokers get what is left (worker, batch, cache)
+ * until 'timeout' ms after n2a_drain_start(); past that deadline nothing
+ * is sent anymore and the messages go to the cache. n2a_drain_finish()
+ * empties the cache while there is time left and logs how it went.
+ */
+void n2a_drain_start (int timeout);
+void n2a_drain_finish (void);
+int n2a_draining (void);
+int n2a_past_deadline (void);
 
 void on_error(int x, char const *context);
 void on_amqp_error(amqp_rpc_reply_t x, char const *context);
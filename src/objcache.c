@@ -0,0 +1,539 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include "nagios.h"
+#include "logger.h"
+#include "xutils.h"
+#include "module.h"
+#include "json.h"
+#include "neb2amqp.h"
+#include "objcache.h"
+#include "intern.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+extern struct options g_options;
+
+static struct n2a_object **table = NULL;
+static size_t table_size = 0;
+static size_t table_count = 0;
+
+static size_t
+hash_ptr (const void *ptr, size_t size)
+{
+    uintptr_t h = (uintptr_t) ptr >> 4;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    return h & (size - 1);
+}
+
+static void
+grow_table (void)
+{
+    size_t size = table_size ? table_size * 2 : 1024, i;
+    struct n2a_object **t = xmalloc (size * sizeof (*t));
+    struct n2a_object *o, *next;
+
+    memset (t, 0, size * sizeof (*t));
+    for (i = 0; i < table_size; i++)
+        for (o = table[i]; o != NULL; o = next) {
+            next = o->next;
+            o->next = t[hash_ptr (o->ptr, size)];
+            t[hash_ptr (o->ptr, size)] = o;
+        }
+    xfree (table);
+    table = t;
+    table_size = size;
+}
+
+static int
+same (const char *a, const char *b)
+{
+    return strcmp (charnull ((char *) a), charnull ((char *) b)) == 0;
+}
+
+static void
+free_object (struct n2a_object *o)
+{
+    xfree (o->host_name);
+    xfree (o->service_description);
+    xfree (o->command_name);
+    xfree (o->prefix);
+}
+
+static void
+set_string (json_t *jdata, const char *field, const char *value)
+{
+    json_t *item = json_string (value);
+    json_object_set (jdata, field, item);
+    json_decref (item);
+}
+
+static json_t *
+group_names (objectlist *l, int service)
+{
+    json_t *names = json_array ();
+    json_t *item;
+
+    for (; l != NULL; l = l->next) {
+        if (l->object_ptr == NULL)
+            continue;
+        item = json_string (charnull (service ?
+            ((servicegroup *) l->object_ptr)->group_name :
+            ((hostgroup *) l->object_ptr)->group_name));
+        json_array_append_new (names, item);
+    }
+    return names;
+}
+
+/* TRUE if 'name' is in the comma separated 'custom_vars' (or it is '*') */
+static int
+wanted_var (const char *name)
+{
+    const char *p = g_options.custom_vars;
+    size_t len = strlen (name), l;
+
+    while (*p) {
+        l = strcspn (p, ",");
+        if ((l == 1 && *p == '*') || (l == len && strncasecmp (p, name, l) == 0))
+            return TRUE;
+        p += l;
+        if (*p == ',')
+            p++;
+    }
+    return FALSE;
+}
+
+static void
+set_custom_vars (json_t *jdata, customvariablesmember *v)
+{
+    json_t *vars = json_object ();
+
+    for (; v != NULL; v = v->next)
+        if (v->variable_name != NULL && wanted_var (v->variable_name))
+            set_string (vars, v->variable_name, charnull (v->variable_value));
+    json_object_set_new (jdata, "custom_variables", vars);
+}
+
+/**
+ * 'address', 'groups' and 'custom_vars': what the nagios objects say
+ * about the host/service.
+ */
+static void
+enrich (json_t *jdata, const void *ptr, int is_service)
+{
+    service *s = is_service ? (service *) ptr : NULL;
+    host *h = is_service ? (s ? s->host_ptr : NULL) : (host *) ptr;
+
+    if (h != NULL && g_options.address)
+        set_string (jdata, "address", charnull (h->address));
+    if (h != NULL && g_options.groups)
+        json_object_set_new (jdata, "hostgroups", group_names (h->hostgroups_ptr, FALSE));
+    if (s != NULL && g_options.groups)
+        json_object_set_new (jdata, "servicegroups", group_names (s->servicegroups_ptr, TRUE));
+    if (*g_options.custom_vars && (s != NULL || h != NULL))
+        set_custom_vars (jdata, s ? s->custom_variables : h->custom_variables);
+}
+
+static struct n2a_meta **metas = NULL;
+static size_t metas_size = 0;
+static size_t metas_count = 0;
+
+static void
+grow_metas (void)
+{
+    size_t size = metas_size ? metas_size * 2 : 1024, i;
+    struct n2a_meta **t = xmalloc (size * sizeof (*t));
+    struct n2a_meta *m, *next;
+
+    memset (t, 0, size * sizeof (*t));
+    for (i = 0; i < metas_size; i++)
+        for (m = metas[i]; m != NULL; m = next) {
+            next = m->next;
+            m->next = t[hash_ptr (m->ptr, size)];
+            t[hash_ptr (m->ptr, size)] = m;
+        }
+    xfree (metas);
+    metas = t;
+    metas_size = size;
+}
+
+static void
+free_meta (struct n2a_meta *m)
+{
+    xfree (m->host_name);
+    xfree (m->service_description);
+    xfree (m->data);
+}
+
+static struct n2a_meta *
+get_meta (const void *ptr, const char *host_name, const char *service_description)
+{
+    struct n2a_meta *m;
+    json_t *jdata;
+    size_t h, len, sep;
+    char *members;
+
+    if (ptr == NULL || !(g_options.address || g_options.groups || *g_options.custom_vars))
+        return NULL;
+
+    if (metas_count >= metas_size)
+        grow_metas ();
+
+    h = hash_ptr (ptr, metas_size);
+    for (m = metas[h]; m != NULL; m = m->next)
+        if (m->ptr == ptr)
+            break;
+
+    if (m == NULL) {
+        m = xmalloc (sizeof (*m));
+        memset (m, 0, sizeof (*m));
+        m->ptr = ptr;
+        m->next = metas[h];
+        metas[h] = m;
+        metas_count++;
+    } else if (m->data != NULL && same (m->host_name, host_name)
+               && (service_description == NULL) == (m->service_description == NULL)
+               && same (m->service_description, service_description)) {
+        return m;
+    }
+
+    free_meta (m);
+    m->host_name = xstrdup (charnull ((char *) host_name));
+    m->service_description = service_description ?
+        xstrdup (service_description) : NULL;
+
+    jdata = json_object ();
+    enrich (jdata, ptr, service_description != NULL);
+    m->count = json_object_size (jdata);
+    members = n2a_encode_members (jdata, &len);
+    json_decref (jdata);
+
+    /* json members follow the prefix with their ', ' */
+    sep = (g_options.encoding == N2A_MSG_MSGPACK || m->count == 0) ? 0 : 2;
+    m->len = sep + len;
+    m->data = xmalloc (m->len + 1);
+    memcpy (m->data, ", ", sep);
+    memcpy (m->data + sep, members, len + 1);
+    xfree (members);
+    return m;
+}
+
+struct n2a_meta *
+n2a_service_meta (nebstruct_service_check_data *c)
+{
+    return get_meta (c->object_ptr, c->host_name, c->service_description);
+}
+
+struct n2a_meta *
+n2a_host_meta (nebstruct_host_check_data *c)
+{
+    return get_meta (c->object_ptr, c->host_name, NULL);
+}
+
+void
+n2a_clear_meta (void)
+{
+    struct n2a_meta *m, *next;
+    size_t i;
+
+    for (i = 0; i < metas_size; i++)
+        for (m = metas[i]; m != NULL; m = next) {
+            next = m->next;
+            free_meta (m);
+            xfree (m);
+        }
+    xfree (metas);
+    metas = NULL;
+    metas_size = metas_count = 0;
+}
+
+/* the prefix ends with the metadata: keep it in line with the one given */
+static void
+set_meta (struct n2a_object *o, const struct n2a_meta *meta)
+{
+    size_t len = meta ? meta->len : 0;
+    char *prefix;
+
+    if (o->prefix_len == o->base_len + len
+        && (len == 0 || memcmp (o->prefix + o->base_len, meta->data, len) == 0))
+        return;
+
+    prefix = xmalloc (o->base_len + len + 1);
+    memcpy (prefix, o->prefix, o->base_len);
+    if (len > 0)
+        memcpy (prefix + o->base_len, meta->data, len);
+    xfree (o->prefix);
+    o->prefix = prefix;
+    o->prefix_len = o->base_len + len;
+    o->prefix[o->prefix_len] = '\0';
+    o->count = o->base_count + (meta ? meta->count : 0);
+}
+
+/**
+ * (re)build an entry. nagios objects are freed and allocated again on
+ * reload, so a pointer may come back for another host/service: the names
+ * are kept to notice it.
+ */
+static void
+build_object (struct n2a_object *o, const char *host_name,
+              const char *service_description, const char *command_name)
+{
+    json_t *jdata = json_object ();
+    size_t l;
+    char *key;
+
+    free_object (o);
+    o->published = FALSE;
+    o->since_full = 0;
+    o->nfields = 0;
+    o->host_name = xstrdup (charnull ((char *) host_name));
+    o->service_description = service_description ?
+        xstrdup (service_description) : NULL;
+    o->command_name = xstrdup (charnull ((char *) command_name));
+
+    set_string (jdata, "connector", g_options.connector);
+    set_string (jdata, "connector_name", g_options.eventsource_name);
+    set_string (jdata, "event_type", "check");
+    set_string (jdata, "source_type",
+                service_description ? "resource" : "component");
+    set_string (jdata, "component", host_name);
+    if (service_description)
+        set_string (jdata, "resource", service_description);
+    set_string (jdata, "command_name", command_name);
+
+    o->count = o->base_count = json_object_size (jdata);
+    o->prefix = n2a_encode_members (jdata, &o->prefix_len);
+    o->base_len = o->prefix_len;
+    json_decref (jdata);
+
+    // "..check.ressource.." + \0 = 20 chars
+    l = xstrlen (g_options.connector) + xstrlen (g_options.eventsource_name)
+        + xstrlen (host_name) + xstrlen (service_description) + 20;
+    l = xmin (g_options.max_size, (int) l);
+    xalloca (key, l);
+    if (service_description)
+        snprintf (key, l, "%s.%s.check.resource.%s.%s",
+                  g_options.connector, g_options.eventsource_name,
+                  host_name, service_description);
+    else
+        snprintf (key, l, "%s.%s.check.component.%s",
+                  g_options.connector, g_options.eventsource_name, host_name);
+    o->key = n2a_intern_string (n2a_intern (key));
+}
+
+static struct n2a_object *
+get_object (const void *ptr, const char *host_name,
+            const char *service_description, const char *command_name,
+            const struct n2a_meta *meta)
+{
+    struct n2a_object *o;
+    size_t h;
+
+    if (table_count >= table_size)
+        grow_table ();
+
+    h = hash_ptr (ptr, table_size);
+    for (o = table[h]; o != NULL; o = o->next)
+        if (o->ptr == ptr)
+            break;
+
+    if (o == NULL) {
+        o = xmalloc (sizeof (*o));
+        memset (o, 0, sizeof (*o));
+        o->ptr = ptr;
+        o->next = table[h];
+        table[h] = o;
+        table_count++;
+    } else if (same (o->host_name, host_name)
+               && (service_description == NULL) == (o->service_description == NULL)
+               && same (o->service_description, service_description)
+               && same (o->command_name, command_name)) {
+        set_meta (o, meta);
+        return o;
+    }
+
+    build_object (o, host_name, service_description, command_name);
+    set_meta (o, meta);
+    return o;
+}
+
+struct n2a_object *
+n2a_service_object (nebstruct_service_check_data *c, const struct n2a_meta *meta)
+{
+    return get_object (c->object_ptr, c->host_name, c->service_description,
+                       c->command_name, meta);
+}
+
+struct n2a_object *
+n2a_host_object (nebstruct_host_check_data *c, const struct n2a_meta *meta)
+{
+    return get_object (c->object_ptr, c->host_name, NULL, c->command_name, meta);
+}
+
+static unsigned int
+hash_output (const char *str)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261U;
+    for (str = charnull ((char *) str); *str; str++) {
+        h ^= (unsigned char) *str;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+int
+n2a_object_changed (struct n2a_object *o, int state, int state_type,
+                    const char *output, time_t now)
+{
+    unsigned int h = hash_output (output);
+
+    if (o->published && o->state == state && o->state_type == state_type
+        && o->output_hash == h
+        && (g_options.refresh <= 0 || now - o->last_sent < g_options.refresh))
+        return FALSE;
+
+    o->published = TRUE;
+    o->state = state;
+    o->state_type = state_type;
+    o->output_hash = h;
+    o->last_sent = now;
+    return TRUE;
+}
+
+static uint64_t
+hash64 (const void *data, size_t len, uint64_t h)
+{
+    /* FNV-1a */
+    const unsigned char *p = data;
+    while (len--) {
+        h ^= *p++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t
+hash_value (json_t *value)
+{
+    uint64_t h = 14695981039346656037ULL;
+    int type = json_typeof (value);
+    json_int_t i;
+    double d;
+    uint64_t sub;
+    size_t n;
+    void *iter;
+
+    h = hash64 (&type, sizeof (type), h);
+    switch (type) {
+        case JSON_OBJECT:
+            for (iter = json_object_iter (value); iter;
+                 iter = json_object_iter_next (value, iter)) {
+                const char *k = json_object_iter_key (iter);
+                h = hash64 (k, strlen (k), h);
+                sub = hash_value (json_object_iter_value (iter));
+                h = hash64 (&sub, sizeof (sub), h);
+            }
+            return h;
+        case JSON_ARRAY:
+            for (n = 0; n < json_array_size (value); n++) {
+                sub = hash_value (json_array_get (value, n));
+                h = hash64 (&sub, sizeof (sub), h);
+            }
+            return h;
+        case JSON_STRING:
+            return hash64 (json_string_value (value),
+                           strlen (json_string_value (value)), h);
+        case JSON_INTEGER:
+            i = json_integer_value (value);
+            return hash64 (&i, sizeof (i), h);
+        case JSON_REAL:
+            d = json_real_value (value);
+            return hash64 (&d, sizeof (d), h);
+        default:
+            return h;
+    }
+}
+
+void
+n2a_object_delta (struct n2a_object *o, json_t *jdata)
+{
+    const char *unchanged[N2A_DELTA_FIELDS];
+    int i, n = 0, full;
+    void *iter;
+    json_t *item;
+
+    full = (o->since_full == 0);
+    o->since_full = (o->since_full + 1) % g_options.delta;
+    if (full)
+        o->nfields = 0;
+
+    for (iter = json_object_iter (jdata); iter;
+         iter = json_object_iter_next (jdata, iter)) {
+        const char *k = json_object_iter_key (iter);
+        uint64_t key = hash64 (k, strlen (k), 14695981039346656037ULL);
+        uint64_t value = hash_value (json_object_iter_value (iter));
+
+        for (i = 0; i < o->nfields && o->field_key[i] != key; i++)
+            ;
+        if (i == o->nfields) {
+            if (o->nfields == N2A_DELTA_FIELDS)
+                continue;
+            o->field_key[o->nfields++] = key;
+        } else if (!full && o->field_value[i] == value && n < N2A_DELTA_FIELDS) {
+            unchanged[n++] = k;
+        }
+        o->field_value[i] = value;
+    }
+    /* json_object_del() would break the iteration above */
+    for (i = 0; i < n; i++)
+        json_object_del (jdata, unchanged[i]);
+
+    o->version++;
+    item = json_integer (o->version);
+    json_object_set (jdata, "version", item);
+    json_decref (item);
+    if (!full) {
+        item = json_integer (o->version - 1);
+        json_object_set (jdata, "base_version", item);
+        json_decref (item);
+    }
+}
+
+void
+n2a_clear_objects (void)
+{
+    struct n2a_object *o, *next;
+    size_t i;
+
+    for (i = 0; i < table_size; i++)
+        for (o = table[i]; o != NULL; o = next) {
+            next = o->next;
+            free_object (o);
+            xfree (o);
+        }
+    xfree (table);
+    table = NULL;
+    table_size = table_count = 0;
+    n2a_clear_meta ();
+}
@@ -0,0 +1,125 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef objcache_h
+#define objcache_h
+
+#include <stddef.h>
+#include <time.h>
+#include <stdint.h>
+
+#include "jansson.h"
+
+#include "nagios.h"
+
+/* dynamic fields of a check tracked by 'delta' */
+#define N2A_DELTA_FIELDS 16
+
+/**
+ * what never changes from one check of a host/service to the next: its
+ * routing key and its constant fields (connector, connector_name,
+ * event_type, source_type, component, resource, command_name, plus the
+ * metadata below) already encoded with the configured 'encoding'. entries
+ * are looked up by the nagios object pointer and built on first use.
+ */
+struct n2a_object
+{
+    const void *ptr;
+    char *host_name;
+    char *service_description;
+    char *command_name;
+    /* routing key of the events of this object, interned */
+    const char *key;
+    /* encoded members, without the object/map header */
+    char *prefix;
+    size_t prefix_len;
+    /* number of members in 'prefix' */
+    size_t count;
+    /* the same without the metadata, which ends the prefix */
+    size_t base_len;
+    size_t base_count;
+    /* last published state, for 'changes_only' */
+    int published;
+    int state;
+    int state_type;
+    unsigned int output_hash;
+    time_t last_sent;
+    /* checks dropped by the rate limit, reported by the next event */
+    int suppressed;
+    /* 'delta': version of the last event and what its fields hashed to */
+    unsigned int version;
+    int since_full;
+    int nfields;
+    uint64_t field_key[N2A_DELTA_FIELDS];
+    uint64_t field_value[N2A_DELTA_FIELDS];
+    struct n2a_object *next;
+};
+
+/**
+ * 'address', groups and custom variables of a host/service, encoded like
+ * the prefix members (with their leading separator). they come from the
+ * live nagios objects, so they are built and read on the nagios thread
+ * only; the worker gets a copy of 'data'.
+ */
+struct n2a_meta
+{
+    const void *ptr;
+    char *host_name;
+    char *service_description;
+    char *data;
+    size_t len;
+    /* number of members in 'data' */
+    size_t count;
+    struct n2a_meta *next;
+};
+
+/* NULL when no metadata is asked for */
+struct n2a_meta *n2a_service_meta (nebstruct_service_check_data *c);
+struct n2a_meta *n2a_host_meta (nebstruct_host_check_data *c);
+
+/* forget the metadata, built again on the next checks */
+void n2a_clear_meta (void);
+
+/* 'meta' is what the object's events carry after the constant fields */
+struct n2a_object *n2a_service_object (nebstruct_service_check_data *c,
+                                       const struct n2a_meta *meta);
+struct n2a_object *n2a_host_object (nebstruct_host_check_data *c,
+                                    const struct n2a_meta *meta);
+
+/**
+ * with 'changes_only', tells whether a check has to be published: its
+ * state, state type or output changed since the last published one, or
+ * the last one is 'refresh' seconds old. the check is then taken as the
+ * new reference.
+ */
+int n2a_object_changed (struct n2a_object *o, int state, int state_type,
+                        const char *output, time_t now);
+
+/**
+ * with 'delta' > 0, turn the dynamic fields 'jdata' of an event into a
+ * delta: the fields equal to the ones of the previous event of the object
+ * are removed and 'version'/'base_version' are added. every 'delta'
+ * events a full event (with 'version' only) is kept instead.
+ */
+void n2a_object_delta (struct n2a_object *o, json_t *jdata);
+
+/* forget every entry, on deinit */
+void n2a_clear_objects (void);
+
+#endif
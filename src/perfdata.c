@@ -0,0 +1,140 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include "xutils.h"
+#include "perfdata.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SPACES " \t\r\n"
+
+/* keep the positions: what can not be represented is null */
+static void
+append (json_t *array, json_t *value)
+{
+    json_array_append_new (array, value ? value : json_null ());
+}
+
+/* a number if 'text' is only that, a string otherwise (ranges), NULL if empty */
+static json_t *
+threshold (char *text)
+{
+    char *end;
+    double d;
+
+    if (*text == '\0')
+        return NULL;
+    d = strtod (text, &end);
+    if (*end == '\0' && isfinite (d))
+        return json_real (d);
+    return json_string (text);
+}
+
+/* copy up to one of 'stops' into 'out', return the end */
+static const char *
+token (const char *p, const char *stops, char *out)
+{
+    size_t n = strcspn (p, stops);
+
+    memcpy (out, p, n);
+    out[n] = '\0';
+    return p + n;
+}
+
+json_t *
+n2a_perfdata_parse (const char *perf_data)
+{
+    json_t *metrics = json_array (), *metric, *label, *value;
+    char *scratch;
+    const char *p = perf_data;
+    char *end;
+    size_t n;
+    int i;
+
+    if (perf_data == NULL || metrics == NULL)
+        return metrics;
+    /* any label, unit or threshold fits in a copy of the whole string */
+    scratch = xmalloc (strlen (perf_data) + 1);
+
+    for (;;) {
+        p += strspn (p, SPACES);
+        if (*p == '\0')
+            break;
+
+        if (*p == '\'') {
+            for (n = 0, p++; *p != '\0'; p++) {
+                if (*p == '\'' && *++p != '\'')
+                    break;
+                scratch[n++] = *p;
+            }
+            scratch[n] = '\0';
+        } else {
+            p = token (p, "=" SPACES, scratch);
+        }
+        if (*p != '=' || scratch[0] == '\0') {
+            p += strcspn (p, SPACES);
+            continue;
+        }
+        p++;
+
+        if (*p == 'U') {
+            value = json_null ();
+            p++;
+        } else {
+            double d = strtod (p, &end);
+            if (end == p) {
+                p += strcspn (p, SPACES);
+                continue;
+            }
+            /* the json encoder would write inf and nan as they are */
+            value = isfinite (d) ? json_real (d) : json_null ();
+            p = end;
+        }
+
+        /* a label which is not UTF-8 or a nan/inf value: no json for it */
+        label = json_string (scratch);
+        if (label == NULL || value == NULL) {
+            json_decref (label);
+            json_decref (value);
+            p += strcspn (p, SPACES);
+            continue;
+        }
+        metric = json_array ();
+        json_array_append_new (metric, label);
+        json_array_append_new (metric, value);
+
+        p = token (p, ";" SPACES, scratch);
+        append (metric, scratch[0] ? json_string (scratch) : NULL);
+
+        /* warn, crit, min, max */
+        for (i = 0; i < 4; i++) {
+            scratch[0] = '\0';
+            if (*p == ';')
+                p = token (p + 1, ";" SPACES, scratch);
+            append (metric, threshold (scratch));
+        }
+        p += strcspn (p, SPACES);
+        json_array_append_new (metrics, metric);
+    }
+
+    xfree (scratch);
+    return metrics;
+}
@@ -0,0 +1,37 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef perfdata_h
+#define perfdata_h
+
+#include <jansson.h>
+
+/**
+ * parse a nagios perf_data string ("'label'=value[uom];[warn];[crit];[min];[max] ...")
+ * into an array of metrics, each one the array
+ * [label, value, uom, warn, crit, min, max] with null for what is missing.
+ * labels may be quoted ('' for a quote), an undetermined value ('U') is
+ * null, a threshold which is a range ("10:20", "@~:5") is kept as a string.
+ * malformed metrics are skipped. one pass over the string, with a single
+ * scratch copy of it; positional arrays rather than objects, which cost a
+ * hash table each.
+ */
+json_t *n2a_perfdata_parse (const char *perf_data);
+
+#endif
@@ -0,0 +1,84 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include "nagios.h"
+#include "logger.h"
+#include "module.h"
+#include "shed.h"
+
+extern struct options g_options;
+
+static const char *levels[] = {
+    "everything", "state changes", "state changes without perf_data",
+    "hard state changes without perf_data"
+};
+
+static double avg_latency = 0;
+static double avg_cost = 0;
+static int level = 0;
+static time_t last_change = 0;
+
+int
+n2a_shed_enabled (void)
+{
+    return g_options.shed_latency > 0 || g_options.shed_cost > 0;
+}
+
+/* TRUE if 'avg' is above 'threshold' times 'factor', never for no threshold */
+static int
+above (double avg, double threshold, double factor)
+{
+    return threshold > 0 && avg > threshold * factor;
+}
+
+void
+n2a_shed_update (double latency, long cost_us, time_t now)
+{
+    int next = level;
+
+    /* exponential moving averages over about 64 checks */
+    avg_latency += (latency - avg_latency) / 64;
+    avg_cost += ((double) cost_us - avg_cost) / 64;
+
+    if (now < last_change + N2A_SHED_HOLD)
+        return;
+
+    if (above (avg_latency, g_options.shed_latency, 1)
+        || above (avg_cost, g_options.shed_cost, 1)) {
+        if (level < N2A_SHED_SOFT)
+            next = level + 1;
+    } else if (!above (avg_latency, g_options.shed_latency, 0.5)
+               && !above (avg_cost, g_options.shed_cost, 0.5)) {
+        if (level > 0)
+            next = level - 1;
+    }
+    if (next == level)
+        return;
+
+    n2a_logger (LG_INFO, "latency %.2fs, %.0fus per check: publishing %s",
+                avg_latency, avg_cost, levels[next]);
+    level = next;
+    last_change = now;
+}
+
+int
+n2a_shed_level (void)
+{
+    return level;
+}
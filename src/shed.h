@@ -0,0 +1,50 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef shed_h
+#define shed_h
+
+#include <time.h>
+
+/**
+ * load shedding: with 'shed_latency' (s) or 'shed_cost' (us) set, the
+ * moving averages of the nagios check latency and of the time spent in
+ * the check callbacks are watched. above the thresholds the module sheds
+ * a level every 'N2A_SHED_HOLD' seconds, below half of them it recovers
+ * a level:
+ *  1: only the checks whose state or state type changed are published
+ *  2: and without perf_data nor long_output
+ *  3: and the soft states are dropped
+ * the snapshot also pauses while shedding.
+ */
+#define N2A_SHED_CHANGES  1
+#define N2A_SHED_PERFDATA 2
+#define N2A_SHED_SOFT     3
+
+#define N2A_SHED_HOLD 10
+
+int n2a_shed_enabled (void);
+
+/* account for one check: its latency and the time its callback took */
+void n2a_shed_update (double latency, long cost_us, time_t now);
+
+/* current level, 0 when everything goes out */
+int n2a_shed_level (void);
+
+#endif
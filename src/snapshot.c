@@ -0,0 +1,223 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include "nagios.h"
+#include "logger.h"
+#include "xutils.h"
+#include "module.h"
+#include "events.h"
+#include "objcache.h"
+#include "filter.h"
+#include "worker.h"
+#include "snapshot.h"
+#include "shed.h"
+#include "batch.h"
+
+#include <string.h>
+#include <sys/time.h>
+
+extern struct options g_options;
+
+#ifndef DEBUG
+extern host *host_list;
+extern service *service_list;
+#endif
+
+static int running = FALSE;
+static time_t next_start = 0;
+/* position of the walk in progress, both NULL when idle */
+static host *next_host = NULL;
+static service *next_service = NULL;
+static int walking = FALSE;
+static int published = 0;
+
+static long
+elapsed_ms (const struct timeval *start)
+{
+    struct timeval now;
+    gettimeofday (&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000
+        + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+static void
+snapshot_host (host *h)
+{
+    nebstruct_host_check_data c;
+
+    memset (&c, 0, sizeof (c));
+    c.type = NEBTYPE_HOSTCHECK_PROCESSED;
+    c.object_ptr = h;
+    c.timestamp.tv_sec = h->last_check;
+    c.host_name = h->name;
+    c.command_name = h->check_command_ptr ? h->check_command_ptr->name : NULL;
+    c.state = h->current_state;
+    c.state_type = h->state_type;
+    c.check_type = h->check_type;
+    c.current_attempt = h->current_attempt;
+    c.max_attempts = h->max_attempts;
+    c.execution_time = h->execution_time;
+    c.latency = h->latency;
+    c.output = h->plugin_output;
+    c.long_output = h->long_plugin_output;
+    c.perf_data = h->perf_data;
+
+    if (!n2a_filter_host (&c, NULL))
+        return;
+    if (n2a_worker_enabled ())
+        n2a_worker_host_check (&c, N2A_SNAPSHOT);
+    else
+        n2a_publish_host_check (&c, n2a_host_meta (&c), N2A_SNAPSHOT);
+    published++;
+}
+
+static void
+snapshot_service (service *s)
+{
+    nebstruct_service_check_data c;
+
+    memset (&c, 0, sizeof (c));
+    c.type = NEBTYPE_SERVICECHECK_PROCESSED;
+    c.object_ptr = s;
+    c.timestamp.tv_sec = s->last_check;
+    c.host_name = s->host_name;
+    c.service_description = s->description;
+    c.command_name = s->check_command_ptr ? s->check_command_ptr->name : NULL;
+    c.state = s->current_state;
+    c.state_type = s->state_type;
+    c.check_type = s->check_type;
+    c.current_attempt = s->current_attempt;
+    c.max_attempts = s->max_attempts;
+    c.execution_time = s->execution_time;
+    c.latency = s->latency;
+    c.output = s->plugin_output;
+    c.long_output = s->long_plugin_output;
+    c.perf_data = s->perf_data;
+
+    if (!n2a_filter_service (&c, NULL))
+        return;
+    if (n2a_worker_enabled ())
+        n2a_worker_service_check (&c, N2A_SNAPSHOT);
+    else
+        n2a_publish_service_check (&c, n2a_service_meta (&c), N2A_SNAPSHOT);
+    published++;
+}
+
+/**
+ * the clock is only read every few objects. the slice also ends when the
+ * worker lags behind, rather than waiting for it in the nagios thread.
+ */
+static int
+slice_over (const struct timeval *start, int n)
+{
+    return n % 32 == 0
+        && (elapsed_ms (start) >= g_options.snapshot_budget || n2a_worker_busy ());
+}
+
+/* go on with the walk until it is over or the slice took its budget */
+static void
+snapshot_slice (void)
+{
+    struct timeval start;
+    int n = 0;
+
+    gettimeofday (&start, NULL);
+    while (next_host != NULL) {
+        host *h = next_host;
+        next_host = h->next;
+        if (h->has_been_checked)
+            snapshot_host (h);
+        if (slice_over (&start, ++n))
+            return;
+    }
+    while (next_service != NULL) {
+        service *s = next_service;
+        next_service = s->next;
+        if (s->has_been_checked)
+            snapshot_service (s);
+        if (slice_over (&start, ++n))
+            return;
+    }
+    walking = FALSE;
+    n2a_logger (LG_DEBUG, "snapshot of %d hosts and services done", published);
+}
+
+static void
+snapshot_timer (void *unused __attribute__ ((__unused__)))
+{
+    time_t now = time (NULL);
+
+    if (!running)
+        return;
+
+    if (!walking && now >= next_start) {
+#ifndef DEBUG
+        next_host = host_list;
+        next_service = service_list;
+#endif
+        walking = TRUE;
+        published = 0;
+        next_start = now + g_options.snapshot;
+    }
+    /* no extra work while nagios is late */
+    if (walking && n2a_shed_level () == 0) {
+        snapshot_slice ();
+        /* the states of the slice went into a batch, it goes out now */
+        if (n2a_worker_enabled ())
+            n2a_worker_flush_batch ();
+        else
+            n2a_batch_flush ();
+    }
+
+#ifndef DEBUG
+    schedule_new_event(EVENT_USER_FUNCTION,
+                       TRUE,
+                       now + 1,
+                       FALSE,
+                       1,
+                       NULL,
+                       TRUE,
+                       (void *)snapshot_timer,
+                       NULL,
+                       0);
+#endif
+}
+
+void
+n2a_init_snapshot (void)
+{
+    if (g_options.snapshot <= 0)
+        return;
+
+    running = TRUE;
+    walking = FALSE;
+    /* the objects are not loaded yet when the module is */
+    next_start = time (NULL) + g_options.snapshot;
+    n2a_logger (LG_INFO, "publishing a snapshot of the states every %ds", g_options.snapshot);
+    snapshot_timer (NULL);
+}
+
+void
+n2a_deinit_snapshot (void)
+{
+    running = FALSE;
+    walking = FALSE;
+    next_host = NULL;
+    next_service = NULL;
+}
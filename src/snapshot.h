@@ -0,0 +1,34 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef snapshot_h
+#define snapshot_h
+
+/**
+ * with 'snapshot' > 0, the current state of every host and service is
+ * published again every 'snapshot' seconds, as check events sent by
+ * batches (whatever 'batch_size' says), so that Canopsis can resynchronize
+ * without waiting for the checks. the object lists are walked a slice per
+ * second, each slice taking at most 'snapshot_budget' ms of the nagios
+ * thread and sending its batches before it ends.
+ */
+void n2a_init_snapshot (void);
+void n2a_deinit_snapshot (void);
+
+#endif
@@ -0,0 +1,470 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include "nagios.h"
+#include "logger.h"
+#include "xutils.h"
+#include "module.h"
+#include "events.h"
+#include "objcache.h"
+#include "batch.h"
+#include "worker.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+extern struct options g_options;
+
+#define N2A_RECORD_SERVICE 0
+#define N2A_RECORD_HOST    1
+/* encoded event: 'host_name' is the routing key, 'body' the message */
+#define N2A_RECORD_MESSAGE 2
+
+/* end of a snapshot slice: the batch holding its states goes out */
+#define N2A_RECORD_FLUSH   3
+
+/* the 'body' of a check is a copy of its metadata, with 'count' members */
+
+/* what the encoders need from a check, nothing more */
+struct n2a_record
+{
+    struct n2a_record *next;
+    int type;
+    void *object_ptr;
+    struct timeval timestamp;
+    struct timeval end_time;
+    int state;
+    int state_type;
+    int check_type;
+    int current_attempt;
+    int max_attempts;
+    double execution_time;
+    double latency;
+    int suppressed;
+    char *host_name;
+    char *service_description;
+    char *command_name;
+    char *output;
+    char *long_output;
+    char *perf_data;
+    char *body;
+    size_t len;
+    size_t count;
+};
+
+/* a record too big for an empty buffer gets its own allocation */
+struct n2a_big
+{
+    struct n2a_big *next;
+};
+
+struct n2a_buffer
+{
+    char *base;
+    size_t size;
+    size_t used;
+    struct n2a_big *big;
+    struct n2a_record *head;
+    struct n2a_record *tail;
+};
+
+static struct n2a_buffer buffers[2];
+static struct n2a_buffer *front = NULL;
+static pthread_t thread;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_free = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static int running = FALSE;
+static int stopping = FALSE;
+static __thread int in_worker = FALSE;
+
+#define ALIGN(n) (((n) + sizeof (double) - 1) & ~(sizeof (double) - 1))
+
+static void *
+buffer_alloc (struct n2a_buffer *b, size_t size)
+{
+    void *p;
+
+    size = ALIGN (size);
+    if (b->used + size > b->size) {
+        struct n2a_big *big = xmalloc (ALIGN (sizeof (*big)) + size);
+        big->next = b->big;
+        b->big = big;
+        return (char *) big + ALIGN (sizeof (*big));
+    }
+    p = b->base + b->used;
+    b->used += size;
+    return p;
+}
+
+static void
+buffer_reset (struct n2a_buffer *b)
+{
+    struct n2a_big *big, *next;
+
+    for (big = b->big; big != NULL; big = next) {
+        next = big->next;
+        xfree (big);
+    }
+    b->big = NULL;
+    b->used = 0;
+    b->head = b->tail = NULL;
+}
+
+static char *
+copy_string (char **p, const char *str)
+{
+    size_t len;
+    char *ret = *p;
+
+    if (str == NULL)
+        return NULL;
+    len = strlen (str) + 1;
+    memcpy (*p, str, len);
+    *p += len;
+    return ret;
+}
+
+/**
+ * copy a check into the current buffer. 'strings' are the strings of the
+ * record, in the order of struct n2a_record, 'body' the raw bytes of
+ * an encoded event, if any.
+ */
+static void
+push (struct n2a_record *r, const char *strings[6], const char *body, size_t len)
+{
+    size_t need = ALIGN (sizeof (*r)) + len;
+    struct n2a_record *rec;
+    char *p;
+    int i;
+
+    for (i = 0; i < 6; i++)
+        need += strings[i] ? strlen (strings[i]) + 1 : 0;
+
+    pthread_mutex_lock (&queue_lock);
+    /* wait for the worker to take the full buffer */
+    while (front->used > 0 && front->used + ALIGN (need) > front->size) {
+        pthread_cond_signal (&queue_work);
+        pthread_cond_wait (&queue_free, &queue_lock);
+    }
+
+    rec = buffer_alloc (front, need);
+    *rec = *r;
+    rec->next = NULL;
+    p = (char *) rec + ALIGN (sizeof (*rec));
+    rec->host_name = copy_string (&p, strings[0]);
+    rec->service_description = copy_string (&p, strings[1]);
+    rec->command_name = copy_string (&p, strings[2]);
+    rec->output = copy_string (&p, strings[3]);
+    rec->long_output = copy_string (&p, strings[4]);
+    rec->perf_data = copy_string (&p, strings[5]);
+    rec->body = NULL;
+    rec->len = len;
+    if (body != NULL) {
+        rec->body = p;
+        memcpy (p, body, len);
+    }
+
+    if (front->tail != NULL)
+        front->tail->next = rec;
+    else
+        front->head = rec;
+    front->tail = rec;
+
+    pthread_cond_signal (&queue_work);
+    pthread_mutex_unlock (&queue_lock);
+}
+
+void
+n2a_worker_service_check (nebstruct_service_check_data *c, int suppressed)
+{
+    struct n2a_record r;
+    const char *strings[6] = { c->host_name, c->service_description,
+        c->command_name, c->output, c->long_output, c->perf_data };
+    struct n2a_meta *meta = n2a_service_meta (c);
+
+    r.type = N2A_RECORD_SERVICE;
+    r.object_ptr = c->object_ptr;
+    r.timestamp = c->timestamp;
+    r.end_time = c->end_time;
+    r.state = c->state;
+    r.state_type = c->state_type;
+    r.check_type = c->check_type;
+    r.current_attempt = c->current_attempt;
+    r.max_attempts = c->max_attempts;
+    r.execution_time = c->execution_time;
+    r.latency = c->latency;
+    r.suppressed = suppressed;
+    r.count = meta ? meta->count : 0;
+    push (&r, strings, meta ? meta->data : NULL, meta ? meta->len : 0);
+}
+
+void
+n2a_worker_host_check (nebstruct_host_check_data *c, int suppressed)
+{
+    struct n2a_record r;
+    const char *strings[6] = { c->host_name, NULL,
+        c->command_name, c->output, c->long_output, c->perf_data };
+    struct n2a_meta *meta = n2a_host_meta (c);
+
+    r.type = N2A_RECORD_HOST;
+    r.object_ptr = c->object_ptr;
+    r.timestamp = c->timestamp;
+    r.end_time = c->end_time;
+    r.state = c->state;
+    r.state_type = c->state_type;
+    r.check_type = c->check_type;
+    r.current_attempt = c->current_attempt;
+    r.max_attempts = c->max_attempts;
+    r.execution_time = c->execution_time;
+    r.latency = c->latency;
+    r.suppressed = suppressed;
+    r.count = meta ? meta->count : 0;
+    push (&r, strings, meta ? meta->data : NULL, meta ? meta->len : 0);
+}
+
+void
+n2a_worker_message (const char *key, const char *message, size_t len)
+{
+    struct n2a_record r;
+    const char *strings[6] = { key, NULL, NULL, NULL, NULL, NULL };
+
+    memset (&r, 0, sizeof (r));
+    r.type = N2A_RECORD_MESSAGE;
+    push (&r, strings, message, len);
+}
+
+void
+n2a_worker_flush_batch (void)
+{
+    struct n2a_record r;
+    const char *strings[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+
+    memset (&r, 0, sizeof (r));
+    r.type = N2A_RECORD_FLUSH;
+    push (&r, strings, NULL, 0);
+}
+
+static void
+publish (struct n2a_record *r)
+{
+    struct n2a_meta meta;
+
+    memset (&meta, 0, sizeof (meta));
+    meta.data = r->body;
+    meta.len = r->len;
+    meta.count = r->count;
+
+    if (r->type == N2A_RECORD_MESSAGE) {
+        n2a_publish_message (r->host_name, r->body, r->len);
+    } else if (r->type == N2A_RECORD_FLUSH) {
+        n2a_batch_flush ();
+    } else if (r->type == N2A_RECORD_SERVICE) {
+        nebstruct_service_check_data c;
+        memset (&c, 0, sizeof (c));
+        c.type = NEBTYPE_SERVICECHECK_PROCESSED;
+        c.object_ptr = r->object_ptr;
+        c.timestamp = r->timestamp;
+        c.end_time = r->end_time;
+        c.host_name = r->host_name;
+        c.service_description = r->service_description;
+        c.command_name = r->command_name;
+        c.state = r->state;
+        c.state_type = r->state_type;
+        c.check_type = r->check_type;
+        c.current_attempt = r->current_attempt;
+        c.max_attempts = r->max_attempts;
+        c.execution_time = r->execution_time;
+        c.latency = r->latency;
+        c.output = r->output;
+        c.long_output = r->long_output;
+        c.perf_data = r->perf_data;
+        n2a_publish_service_check (&c, r->body ? &meta : NULL, r->suppressed);
+    } else {
+        nebstruct_host_check_data c;
+        memset (&c, 0, sizeof (c));
+        c.type = NEBTYPE_HOSTCHECK_PROCESSED;
+        c.object_ptr = r->object_ptr;
+        c.timestamp = r->timestamp;
+        c.end_time = r->end_time;
+        c.host_name = r->host_name;
+        c.command_name = r->command_name;
+        c.state = r->state;
+        c.state_type = r->state_type;
+        c.check_type = r->check_type;
+        c.current_attempt = r->current_attempt;
+        c.max_attempts = r->max_attempts;
+        c.execution_time = r->execution_time;
+        c.latency = r->latency;
+        c.output = r->output;
+        c.long_output = r->long_output;
+        c.perf_data = r->perf_data;
+        n2a_publish_host_check (&c, r->body ? &meta : NULL, r->suppressed);
+    }
+}
+
+static void *
+worker (void *unused __attribute__ ((__unused__)))
+{
+    struct n2a_buffer *back;
+    struct n2a_record *r;
+    sigset_t set;
+
+    /* nagios' signals are for the main thread */
+    sigfillset (&set);
+    pthread_sigmask (SIG_BLOCK, &set, NULL);
+    in_worker = TRUE;
+
+    pthread_mutex_lock (&queue_lock);
+    for (;;) {
+        while (front->head == NULL && !stopping)
+            pthread_cond_wait (&queue_work, &queue_lock);
+        if (front->head == NULL)
+            break;
+        /* swap the buffers, the callbacks go on with the empty one */
+        back = front;
+        front = (front == &buffers[0]) ? &buffers[1] : &buffers[0];
+        pthread_cond_broadcast (&queue_free);
+        pthread_mutex_unlock (&queue_lock);
+
+        for (r = back->head; r != NULL; r = r->next) {
+            n2a_lock ();
+            publish (r);
+            n2a_unlock ();
+        }
+        buffer_reset (back);
+
+        pthread_mutex_lock (&queue_lock);
+    }
+    pthread_mutex_unlock (&queue_lock);
+    return NULL;
+}
+
+int
+n2a_worker_enabled (void)
+{
+    return running;
+}
+
+int
+n2a_in_worker (void)
+{
+    return in_worker;
+}
+
+/* the lines logged by the worker go out from the nagios thread */
+static void
+log_timer (void *unused __attribute__ ((__unused__)))
+{
+    n2a_flush_log ();
+#ifndef DEBUG
+    if (running)
+        schedule_new_event(EVENT_USER_FUNCTION,
+                           TRUE,
+                           time (NULL) + 1,
+                           FALSE,
+                           1,
+                           NULL,
+                           TRUE,
+                           (void *)log_timer,
+                           NULL,
+                           0);
+#endif
+}
+
+int
+n2a_worker_busy (void)
+{
+    int busy;
+
+    if (!running)
+        return FALSE;
+    pthread_mutex_lock (&queue_lock);
+    busy = front->used > front->size / 2;
+    pthread_mutex_unlock (&queue_lock);
+    return busy;
+}
+
+void
+n2a_start_worker (void)
+{
+    int i;
+
+    if (!g_options.worker)
+        return;
+
+    for (i = 0; i < 2; i++) {
+        memset (&buffers[i], 0, sizeof (buffers[i]));
+        buffers[i].size = g_options.worker_buffer;
+        buffers[i].base = xmalloc (buffers[i].size);
+    }
+    front = &buffers[0];
+    stopping = FALSE;
+
+    /* set first so that the thread takes the global lock from the start */
+    running = TRUE;
+    if (pthread_create (&thread, NULL, worker, NULL) != 0) {
+        n2a_logger (LG_CRIT, "cannot start the worker thread, checks will be encoded inline");
+        running = FALSE;
+        for (i = 0; i < 2; i++)
+            xfree (buffers[i].base);
+        return;
+    }
+    n2a_logger (LG_INFO, "worker thread started (%d bytes buffers)",
+                g_options.worker_buffer);
+    log_timer (NULL);
+}
+
+void
+n2a_stop_worker (void)
+{
+    int i;
+
+    if (!running)
+        return;
+
+    pthread_mutex_lock (&queue_lock);
+    stopping = TRUE;
+    pthread_cond_signal (&queue_work);
+    pthread_mutex_unlock (&queue_lock);
+    pthread_join (thread, NULL);
+    running = FALSE;
+
+    for (i = 0; i < 2; i++) {
+        buffer_reset (&buffers[i]);
+        xfree (buffers[i].base);
+    }
+    n2a_logger (LG_INFO, "worker thread stopped");
+}
+
+void
+n2a_lock (void)
+{
+    if (running)
+        pthread_mutex_lock (&global_lock);
+}
+
+void
+n2a_unlock (void)
+{
+    if (running)
+        pthread_mutex_unlock (&global_lock);
+}
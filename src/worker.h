@@ -0,0 +1,66 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#ifndef worker_h
+#define worker_h
+
+#include "nagios.h"
+
+/**
+ * deferred serialization: with 'worker' enabled the callbacks only copy
+ * the fields of a check into a compact record (strings in a bump arena)
+ * and a thread does the encoding, the routing keys and the publishing.
+ * records go into one of two buffers of 'worker_buffer' bytes while the
+ * thread works on the other one; when both are full the callback waits.
+ */
+void n2a_start_worker (void);
+
+/* publish what is left and stop the thread */
+void n2a_stop_worker (void);
+
+/* returns TRUE if the checks have to go through the worker */
+int n2a_worker_enabled (void);
+
+/**
+ * TRUE when called from the worker thread, which must not call into
+ * nagios: its log lines are written later by n2a_flush_log.
+ */
+int n2a_in_worker (void);
+
+void n2a_worker_service_check (nebstruct_service_check_data *c, int suppressed);
+void n2a_worker_host_check (nebstruct_host_check_data *c, int suppressed);
+
+/* TRUE when the buffer being filled is mostly full: pushing more may wait */
+int n2a_worker_busy (void);
+
+/* an event already encoded, published after the checks queued before it */
+void n2a_worker_message (const char *key, const char *message, size_t len);
+
+/* send the pending batch once the records queued before are published */
+void n2a_worker_flush_batch (void);
+
+/**
+ * the connections, the cache and the batch are shared by the worker and
+ * the nagios timers: these serialize them while the worker runs and do
+ * nothing otherwise.
+ */
+void n2a_lock (void);
+void n2a_unlock (void);
+
+#endif
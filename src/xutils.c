@@ -163,3 +163,61 @@ xstrdup(const char *dup)
         strncpy(copy, dup, len + 1);
     return copy;
 }
+
+static const char b64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+char *
+xbase64_encode(const char *src, size_t len)
+{
+    const unsigned char *in = (const unsigned char *) src;
+    char *ret = xmalloc(((len + 2) / 3) * 4 + 1);
+    char *out = ret;
+    size_t i;
+    for (i = 0; i + 2 < len; i += 3) {
+        *out++ = b64[in[i] >> 2];
+        *out++ = b64[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+        *out++ = b64[((in[i + 1] & 0x0f) << 2) | (in[i + 2] >> 6)];
+        *out++ = b64[in[i + 2] & 0x3f];
+    }
+    if (i < len) {
+        *out++ = b64[in[i] >> 2];
+        if (i + 1 < len) {
+            *out++ = b64[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+            *out++ = b64[(in[i + 1] & 0x0f) << 2];
+        } else {
+            *out++ = b64[(in[i] & 0x03) << 4];
+            *out++ = '=';
+        }
+        *out++ = '=';
+    }
+    *out = '\0';
+    return ret;
+}
+
+char *
+xbase64_decode(const char *src, size_t *len)
+{
+    size_t n = xstrlen(src), i;
+    unsigned int acc = 0;
+    int bits = 0;
+    char *ret, *out;
+    if (n % 4 != 0)
+        return NULL;
+    ret = out = xmalloc(n / 4 * 3 + 1);
+    for (i = 0; i < n && src[i] != '='; i++) {
+        const char *p = strchr(b64, src[i]);
+        if (p == NULL || src[i] == '\0') {
+            xfree(ret);
+            return NULL;
+        }
+        acc = (acc << 6) | (unsigned int) (p - b64);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            *out++ = (char) ((acc >> bits) & 0xff);
+        }
+    }
+    *len = out - ret;
+    return ret;
+}
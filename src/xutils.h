@@ -109,4 +109,20 @@ char *xstrdup(const char *dup);
 */
 size_t xstrlen(const char *src);
 
+/**
+* Encodes a binary buffer in base64
+* @param src Buffer to encode
+* @param len Size of src
+* @return A newly allocated NUL terminated string
+*/
+char *xbase64_encode(const char *src, size_t len);
+
+/**
+* Decodes a base64 string
+* @param src String to decode
+* @param len Set to the size of the decoded buffer
+* @return A newly allocated buffer, NULL if src is not valid base64
+*/
+char *xbase64_decode(const char *src, size_t *len);
+
 #endif                            // strutil_h
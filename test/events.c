@@ -0,0 +1,244 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+
+#include "module.h"
+#include "json.h"
+#include "compress.h"
+#include "filter.h"
+
+/* the module globals and callbacks json.c relies on */
+struct options g_options;
+
+void
+n2a_logger (int priority, const char *loginfo, ...)
+{
+}
+
+int
+n2a_limit_enabled (void)
+{
+    return 0;
+}
+
+int
+n2a_compress_wanted (size_t len)
+{
+    return 0;
+}
+
+char *
+n2a_compress (const char *in, size_t len, size_t *zlen)
+{
+    return NULL;
+}
+
+void
+n2a_object_delta (struct n2a_object *o, json_t *jdata)
+{
+}
+
+static int failed = 0;
+
+static void
+expect (int ok, const char *what)
+{
+    if (!ok) {
+        fprintf (stderr, "FAIL %s\n", what);
+        failed++;
+    }
+}
+
+static void
+expect_string (json_t *jdata, const char *field, const char *value, const char *what)
+{
+    const char *got = json_string_value (json_object_get (jdata, field));
+    if (got == NULL || strcmp (got, value) != 0) {
+        fprintf (stderr, "FAIL %s: %s is '%s', expected '%s'\n", what, field,
+                 got ? got : "(null)", value);
+        failed++;
+    }
+}
+
+static void
+expect_key (char *key, const char *value, const char *what)
+{
+    if (key == NULL || strcmp (key, value) != 0) {
+        fprintf (stderr, "FAIL %s: key '%s', expected '%s'\n", what,
+                 key ? key : "(null)", value);
+        failed++;
+    }
+    free (key);
+}
+
+/* the exact-size encoder gives back the very same event */
+static void
+expect_encoded (json_t *jdata, const char *what)
+{
+    size_t len = n2a_encoded_size (jdata);
+    char *buffer = n2a_encode (jdata, len);
+    json_t *back = json_loads (buffer, 0, NULL);
+
+    expect (strlen (buffer) == len, what);
+    expect (back != NULL && json_equal (back, jdata), what);
+    json_decref (back);
+    free (buffer);
+}
+
+static void
+test_acknowledgement (void)
+{
+    nebstruct_acknowledgement_data c;
+    json_t *jdata;
+    char *key = NULL;
+
+    memset (&c, 0, sizeof (c));
+    c.type = NEBTYPE_ACKNOWLEDGEMENT_ADD;
+    c.timestamp.tv_sec = 1000;
+    c.host_name = "web01";
+    c.service_description = "disk /";
+    c.state = 2;
+    c.author_name = "admin";
+    c.comment_data = "on it \"now\"";
+    c.is_sticky = 1;
+
+    jdata = nebstruct_acknowledgement_data_to_json (&c, &key);
+    expect_key (key, "nagios.Debug.ack.resource.web01.disk /", "ack");
+    expect_string (jdata, "event_type", "ack", "ack");
+    expect_string (jdata, "source_type", "resource", "ack");
+    expect_string (jdata, "author", "admin", "ack");
+    expect_string (jdata, "output", "on it \"now\"", "ack");
+    expect (json_integer_value (json_object_get (jdata, "state")) == 2, "ack: state");
+    expect (json_integer_value (json_object_get (jdata, "sticky")) == 1, "ack: sticky");
+    expect_encoded (jdata, "ack: encoded");
+    json_decref (jdata);
+
+    /* an acknowledged host has no resource */
+    c.service_description = NULL;
+    jdata = nebstruct_acknowledgement_data_to_json (&c, &key);
+    expect_key (key, "nagios.Debug.ack.component.web01", "host ack");
+    expect_string (jdata, "source_type", "component", "host ack");
+    expect (json_object_get (jdata, "resource") == NULL, "host ack: no resource");
+    json_decref (jdata);
+}
+
+static void
+test_downtime (void)
+{
+    static const struct { int type; const char *action; } actions[] = {
+        { NEBTYPE_DOWNTIME_ADD, "add" },
+        { NEBTYPE_DOWNTIME_DELETE, "delete" },
+        { NEBTYPE_DOWNTIME_START, "start" },
+        { NEBTYPE_DOWNTIME_STOP, "stop" },
+    };
+    nebstruct_downtime_data c;
+    json_t *jdata;
+    char *key = NULL;
+    int i;
+
+    memset (&c, 0, sizeof (c));
+    c.timestamp.tv_sec = 1000;
+    c.host_name = "web01";
+    c.author_name = "admin";
+    c.comment_data = "maintenance";
+    c.start_time = 2000;
+    c.end_time = 5600;
+    c.duration = 3600;
+    c.fixed = 1;
+    c.downtime_id = 42;
+
+    for (i = 0; i < 4; i++) {
+        c.type = actions[i].type;
+        jdata = nebstruct_downtime_data_to_json (&c, &key);
+        expect_key (key, "nagios.Debug.downtime.component.web01", "downtime");
+        expect_string (jdata, "action", actions[i].action, "downtime");
+        expect (json_integer_value (json_object_get (jdata, "downtime_id")) == 42
+                && json_integer_value (json_object_get (jdata, "end")) == 5600,
+                "downtime: fields");
+        expect_encoded (jdata, "downtime: encoded");
+        json_decref (jdata);
+    }
+}
+
+static void
+test_comment (void)
+{
+    nebstruct_comment_data c;
+    json_t *jdata;
+    char *key = NULL;
+
+    memset (&c, 0, sizeof (c));
+    c.type = NEBTYPE_COMMENT_DELETE;
+    c.timestamp.tv_sec = 1000;
+    c.host_name = "web01";
+    c.service_description = "http";
+    c.author_name = "admin";
+    c.comment_data = "flapping";
+    c.comment_id = 7;
+
+    jdata = nebstruct_comment_data_to_json (&c, &key);
+    expect_key (key, "nagios.Debug.comment.resource.web01.http", "comment");
+    expect_string (jdata, "action", "delete", "comment");
+    expect_string (jdata, "output", "flapping", "comment");
+    expect (json_integer_value (json_object_get (jdata, "comment_id")) == 7,
+            "comment: comment_id");
+    expect_encoded (jdata, "comment: encoded");
+    json_decref (jdata);
+}
+
+static void
+test_program_status (void)
+{
+    nebstruct_program_status_data c;
+    json_t *jdata;
+    char *key = NULL;
+
+    memset (&c, 0, sizeof (c));
+    c.type = NEBTYPE_PROGRAMSTATUS_UPDATE;
+    c.timestamp.tv_sec = 1000;
+    c.pid = 1234;
+    c.notifications_enabled = 1;
+
+    /* the nagios instance is the component */
+    jdata = nebstruct_program_status_data_to_json (&c, &key);
+    expect_key (key, "nagios.Debug.program_status.component.Debug", "program_status");
+    expect_string (jdata, "component", "Debug", "program_status");
+    expect (json_integer_value (json_object_get (jdata, "pid")) == 1234,
+            "program_status: pid");
+    expect_encoded (jdata, "program_status: encoded");
+    json_decref (jdata);
+}
+
+int main (int args, char **argv) {
+    g_options.connector = "nagios";
+    g_options.eventsource_name = "Debug";
+
+    fprintf (stdout, "Testing the acknowledgement, downtime, comment and program status events\n");
+    test_acknowledgement ();
+    test_downtime ();
+    test_comment ();
+    test_program_status ();
+    fprintf (stdout, "%s\n", failed ? "FAILED" : "passed");
+    return failed != 0;
+}
@@ -0,0 +1,261 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "module.h"
+#include "filter.h"
+#include "shed.h"
+
+/* the module globals and callbacks filter.c relies on */
+struct options g_options;
+static int shed_level = 0;
+static int regexec_calls = 0;
+
+void
+n2a_logger (int priority, const char *loginfo, ...)
+{
+}
+
+char *
+charnull (char *data)
+{
+    return data == NULL ? "" : data;
+}
+
+int
+n2a_shed_enabled (void)
+{
+    return shed_level > 0;
+}
+
+int
+n2a_shed_level (void)
+{
+    return shed_level;
+}
+
+/* linked with --wrap=regexec, to count how often the rules are matched */
+int __real_regexec (const regex_t *re, const char *s, size_t n, regmatch_t *m, int flags);
+
+int
+__wrap_regexec (const regex_t *re, const char *s, size_t n, regmatch_t *m, int flags)
+{
+    regexec_calls++;
+    return __real_regexec (re, s, n, m, flags);
+}
+
+static int failed = 0;
+
+static void
+expect (int ok, const char *what)
+{
+    if (!ok) {
+        fprintf (stderr, "FAIL %s\n", what);
+        failed++;
+    }
+}
+
+static void
+setup (char *include, char *exclude)
+{
+    memset (&g_options, 0, sizeof (g_options));
+    g_options.burst = 1;
+    if (include != NULL)
+        g_options.include[g_options.ninclude++] = include;
+    if (exclude != NULL)
+        g_options.exclude[g_options.nexclude++] = exclude;
+    shed_level = 0;
+    n2a_init_filter ();
+    regexec_calls = 0;
+}
+
+/**
+ * a check as nagios sends it: the names are fresh copies each time, only
+ * the object pointer stays the same. the caller frees it with done().
+ */
+static nebstruct_service_check_data
+check (void *object, const char *command, int state, int state_type, long sec)
+{
+    nebstruct_service_check_data c;
+
+    memset (&c, 0, sizeof (c));
+    c.object_ptr = object;
+    c.host_name = strdup ("web01");
+    c.service_description = strdup ("disk /");
+    c.command_name = strdup (command);
+    c.state = state;
+    c.state_type = state_type;
+    c.timestamp.tv_sec = sec;
+    return c;
+}
+
+static void
+done (nebstruct_service_check_data *c)
+{
+    free (c->host_name);
+    free (c->service_description);
+    free (c->command_name);
+}
+
+static int
+filter_check (void *object, const char *command, int state, int state_type, long sec,
+              int *suppressed)
+{
+    nebstruct_service_check_data c = check (object, command, state, state_type, sec);
+    int r = n2a_filter_service (&c, suppressed);
+    done (&c);
+    return r;
+}
+
+/* the rules run once per object, not once per check */
+static void
+test_verdict_cache (void)
+{
+    int object, suppressed, calls;
+
+    setup ("host:web*", "command:check_ping");
+    expect (filter_check (&object, "check_disk", 0, HARD_STATE, 0, &suppressed),
+            "verdict: included");
+    calls = regexec_calls;
+    expect (calls > 0, "verdict: rules evaluated");
+    expect (filter_check (&object, "check_disk", 0, HARD_STATE, 1, &suppressed),
+            "verdict: included again");
+    expect (regexec_calls == calls, "verdict: same names, no regexec");
+    expect (!filter_check (&object, "check_ping", 0, HARD_STATE, 2, &suppressed),
+            "verdict: new command excluded");
+    expect (regexec_calls > calls, "verdict: new command, rules evaluated again");
+    n2a_deinit_filter ();
+}
+
+/* 'burst' checks go out at once, the next one waits for a token */
+static void
+test_rate_limit (void)
+{
+    char rule[] = "60:2:host:web*";
+    int object, suppressed, i;
+
+    setup (NULL, NULL);
+    g_options.limit = 60;
+    g_options.burst = 3;
+    for (i = 0; i < 3; i++)
+        expect (filter_check (&object, "check_disk", 0, HARD_STATE, 100, &suppressed)
+                && suppressed == 0, "limit: burst published");
+    expect (!filter_check (&object, "check_disk", 0, HARD_STATE, 100, &suppressed),
+            "limit: burst + 1 suppressed");
+    /* another check command is still the same object, and the same bucket */
+    expect (!filter_check (&object, "check_disk_v2", 0, HARD_STATE, 100, &suppressed),
+            "limit: new command suppressed too");
+    /* one token per second at 60/min */
+    expect (filter_check (&object, "check_disk_v2", 0, HARD_STATE, 101, &suppressed)
+            && suppressed == 2, "limit: refilled, suppressed checks reported");
+    expect (!filter_check (&object, "check_disk_v2", 0, HARD_STATE, 101, &suppressed),
+            "limit: bucket empty again");
+    n2a_deinit_filter ();
+
+    /* same with a 'limit_rule' and no default limit */
+    memset (&g_options, 0, sizeof (g_options));
+    g_options.limit_rule[g_options.nlimit_rule++] = rule;
+    n2a_init_filter ();
+    for (i = 0; i < 2; i++)
+        expect (filter_check (&object, "check_disk", 0, HARD_STATE, 100, &suppressed),
+                "limit_rule: burst published");
+    expect (!filter_check (&object, "check_disk", 0, HARD_STATE, 100, &suppressed),
+            "limit_rule: burst + 1 suppressed");
+    expect (filter_check (&object, "check_disk", 0, HARD_STATE, 101, &suppressed)
+            && suppressed == 1, "limit_rule: refilled, suppressed check reported");
+    n2a_deinit_filter ();
+}
+
+/* shedding changes only: an unchanged state is dropped */
+static void
+test_shed_changes (void)
+{
+    int object, suppressed;
+
+    setup (NULL, NULL);
+    shed_level = N2A_SHED_CHANGES;
+    expect (filter_check (&object, "check_disk", 0, HARD_STATE, 100, &suppressed),
+            "shed: first state published");
+    expect (!filter_check (&object, "check_disk", 0, HARD_STATE, 101, &suppressed),
+            "shed: same state dropped");
+    expect (!filter_check (&object, "check_disk_v2", 0, HARD_STATE, 102, &suppressed),
+            "shed: same state with a new command dropped");
+    expect (filter_check (&object, "check_disk", 2, SOFT_STATE, 103, &suppressed)
+            && suppressed == 2, "shed: new state published");
+    expect (filter_check (&object, "check_disk", 2, HARD_STATE, 104, &suppressed),
+            "shed: new state type published");
+    expect (!filter_check (&object, "check_disk", 2, HARD_STATE, 105, &suppressed),
+            "shed: same hard state dropped");
+
+    /* and the soft states on top of it */
+    shed_level = N2A_SHED_SOFT;
+    expect (!filter_check (&object, "check_disk", 0, SOFT_STATE, 106, &suppressed),
+            "shed: soft state dropped");
+    expect (filter_check (&object, "check_disk", 0, HARD_STATE, 107, &suppressed),
+            "shed: hard state change published");
+    n2a_deinit_filter ();
+}
+
+static int
+sample_check (void *object, const char *command, long sec)
+{
+    nebstruct_service_check_data c = check (object, command, 0, HARD_STATE, sec);
+    int r = n2a_sample_service (&c);
+    done (&c);
+    return r;
+}
+
+/* perf_data is only kept on the sampled checks */
+static void
+test_sampling (void)
+{
+    char every[] = "3:host:web*", interval[] = "60s:host:web*";
+    int object, i;
+
+    memset (&g_options, 0, sizeof (g_options));
+    g_options.perfdata_sample[g_options.nperfdata_sample++] = every;
+    n2a_init_filter ();
+    for (i = 0; i < 7; i++)
+        expect (sample_check (&object, i == 4 ? "check_disk_v2" : "check_disk", 100 + i)
+                == (i % 3 == 0), "sample: every third perf_data kept");
+    n2a_deinit_filter ();
+
+    g_options.perfdata_sample[0] = interval;
+    n2a_init_filter ();
+    expect (sample_check (&object, "check_disk", 100), "sample: first perf_data kept");
+    expect (!sample_check (&object, "check_disk", 130), "sample: dropped within interval");
+    expect (!sample_check (&object, "check_disk", 159), "sample: dropped until the end");
+    expect (sample_check (&object, "check_disk", 160), "sample: kept after interval");
+    expect (!sample_check (&object, "check_disk", 161), "sample: dropped again");
+    n2a_deinit_filter ();
+}
+
+int main (int args, char **argv) {
+    fprintf (stdout, "Testing the check filters\n");
+    test_verdict_cache ();
+    test_rate_limit ();
+    test_shed_changes ();
+    test_sampling ();
+    fprintf (stdout, "%s\n", failed ? "FAILED" : "passed");
+    return failed != 0;
+}
@@ -0,0 +1,129 @@
+/*--------------------------------
+# Copyright (c) 2011 "Capensis" [http://www.capensis.com]
+#
+# This file is part of Canopsis.
+#
+# Canopsis is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Canopsis is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with Canopsis.  If not, see <http://www.gnu.org/licenses/>.
+# ---------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <jansson.h>
+
+#include "perfdata.h"
+
+#define BENCH_METRICS 200
+#define BENCH_LOOPS 20000
+
+struct test
+{
+    const char *perf_data;
+    const char *expected;
+};
+
+static const struct test tests[] = {
+    { "", "[]" },
+    { "   ", "[]" },
+    { "'a b'=1.5ms;2;3;0;10",
+      "[[\"a b\", 1.5, \"ms\", 2.0, 3.0, 0.0, 10.0]]" },
+    /* '' is a quote in a quoted label */
+    { "'it''s'=3%", "[[\"it's\", 3.0, \"%\", null, null, null, null]]" },
+    { "''''=1", "[[\"'\", 1.0, null, null, null, null, null]]" },
+    /* undetermined value */
+    { "c=U", "[[\"c\", null, null, null, null, null, null]]" },
+    { "c=U;1;2", "[[\"c\", null, null, 1.0, 2.0, null, null]]" },
+    /* ranges stay strings */
+    { "d=4;10:20;@~:5;;",
+      "[[\"d\", 4.0, null, \"10:20\", \"@~:5\", null, null]]" },
+    { "d=4;10:;~:", "[[\"d\", 4.0, null, \"10:\", \"~:\", null, null]]" },
+    /* no json number for them: null value, string threshold */
+    { "a=inf b=1;nan c=-inf;;;NaN",
+      "[[\"a\", null, null, null, null, null, null], "
+      "[\"b\", 1.0, null, \"nan\", null, null, null], "
+      "[\"c\", null, null, null, null, \"NaN\", null]]" },
+    /* malformed metrics are skipped, the others kept */
+    { "bad=x e=5KB;;;; =3 f", "[[\"e\", 5.0, \"KB\", null, null, null, null]]" },
+    { "x=1 'unterminated=4", "[[\"x\", 1.0, null, null, null, null, null]]" },
+    { "'unterminated=4 y=2", "[]" },
+    { "x=1;2;3;4;5;6 y=2",
+      "[[\"x\", 1.0, null, 2.0, 3.0, 4.0, 5.0], "
+      "[\"y\", 2.0, null, null, null, null, null]]" },
+    { "\xff=3 'x\xff'=2 z=1", "[[\"z\", 1.0, null, null, null, null, null]]" },
+    { NULL, NULL }
+};
+
+static double
+now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int
+check (const struct test *t)
+{
+    json_t *metrics = n2a_perfdata_parse (t->perf_data);
+    char *got = json_dumps (metrics, 0);
+    int ok = got != NULL && strcmp (got, t->expected) == 0;
+
+    if (!ok)
+        fprintf (stderr, "FAIL '%s'\n  got:      %s\n  expected: %s\n",
+                 t->perf_data, got ? got : "(null)", t->expected);
+    free (got);
+    json_decref (metrics);
+    return ok;
+}
+
+static void
+bench (int nmetrics)
+{
+    char *perf_data = malloc (nmetrics * 80), *p = perf_data;
+    double start, elapsed;
+    size_t total = 0;
+    int i;
+
+    *p = '\0';
+    for (i = 0; i < nmetrics; i++)
+        p += sprintf (p, "'tbs_%d usage'=%d.%02dMB;28800;31360;0;32000 ",
+                      i, i * 7, i % 100);
+
+    start = now ();
+    for (i = 0; i < BENCH_LOOPS; i++) {
+        json_t *metrics = n2a_perfdata_parse (perf_data);
+        total += json_array_size (metrics);
+        json_decref (metrics);
+    }
+    elapsed = (now () - start) / BENCH_LOOPS;
+
+    fprintf (stdout, "%d metrics, %lu bytes: %.1fus per parse (%.0f MB/s)\n",
+             (int) (total / BENCH_LOOPS), (unsigned long) strlen (perf_data),
+             elapsed * 1e6, strlen (perf_data) / elapsed / 1e6);
+    free (perf_data);
+}
+
+int main (int args, char **argv) {
+    int i, failed = 0;
+
+    fprintf (stdout, "Testing the perfdata parser\n");
+    for (i = 0; tests[i].perf_data != NULL; i++)
+        failed += !check (&tests[i]);
+    fprintf (stdout, "%d/%d cases passed\n", i - failed, i);
+
+    bench (args > 1 ? atoi (argv[1]) : BENCH_METRICS);
+    return failed != 0;
+}